@@ -0,0 +1,333 @@
+/* vim:ts=2:sw=2:expandtab */
+
+#include "gdsl-batch.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define __BATCH_BLOCK (1024*1024)
+/* bytes of a hex line that are passed to the decoder */
+#define __BATCH_LINEBYTES 32
+
+struct __batchWorker {
+  pthread_t thread;
+  const gdsl_batch* batch;
+  const char* from;
+  const char* to;
+  struct __buffer out;
+};
+
+struct __batchState {
+  const gdsl_batch* batch;
+  int fd;
+  int failed;
+  struct __buffer out;
+  struct __batchWorker* workers;
+};
+
+void gdsl_batch_append (struct __buffer* b, const char* s, __word n) {
+  if (b->cap - b->len < n + 1) {
+    __word cap = b->cap == 0 ? 256 : b->cap;
+    while (cap - b->len < n + 1)
+      cap *= 2;
+    char* data = realloc(b->data,cap);
+    if (data == NULL)
+      __fatal("out of memory (batch output)");
+    b->data = data;
+    b->cap = cap;
+  }
+  memcpy(b->data+b->len,s,n);
+  b->len += n;
+  b->data[b->len] = '\0';
+}
+
+static void __batchString (struct __buffer* b, const char* s) {
+  gdsl_batch_append(b,s,strlen(s));
+}
+
+static int __batchFlush (struct __batchState* s) {
+  const char* p = s->out.data;
+  __word n = s->out.len;
+  while (n > 0 && !s->failed) {
+    ssize_t w = write(s->fd,p,n);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      s->failed = 1;
+    else {
+      p += w;
+      n -= w;
+    }
+  }
+  s->out.len = 0;
+  return (s->failed ? -1 : 0);
+}
+
+static inline int __hexDigit (char c) {
+  if (c >= '0' && c <= '9')
+    return (c - '0');
+  if (c >= 'a' && c <= 'f')
+    return (c - 'a' + 10);
+  if (c >= 'A' && c <= 'F')
+    return (c - 'A' + 10);
+  return (-1);
+}
+
+static inline int __isSeparator (char c) {
+  return (c == ' ' || c == '\t' || c == ',' || c == '\r');
+}
+
+/* Parses a hex line into `blob`; a token is a single digit or pairs of
+ * digits, optionally prefixed with `0x`. Returns the number of bytes or
+ * -1 if the line is not hex or longer than `__BATCH_LINEBYTES` bytes. */
+static int __parseHex (const char* p, const char* end, __char* blob) {
+  int n = 0;
+  while (p < end) {
+    if (__isSeparator(*p)) {
+      p++;
+      continue;
+    }
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+      p += 2;
+    const char* t = p;
+    while (p < end && __hexDigit(*p) >= 0)
+      p++;
+    __word k = p - t;
+    if (k == 0 || (p < end && !__isSeparator(*p)) || (k > 1 && k % 2 == 1))
+      return (-1);
+    if (n + (k + 1)/2 > __BATCH_LINEBYTES)
+      return (-1);
+    if (k == 1) {
+      blob[n++] = __hexDigit(t[0]);
+      continue;
+    }
+    for (; t < p; t += 2)
+      blob[n++] = (__hexDigit(t[0]) << 4) | __hexDigit(t[1]);
+  }
+  return (n);
+}
+
+static void __batchLine (const gdsl_batch* b, const char* p, const char* end, struct __buffer* out) {
+  __char blob[__BATCH_LINEBYTES];
+  int n = __parseHex(p,end,blob);
+  if (n == 0)
+    return;
+  if (n < 0) {
+    __batchString(out,"invalid input\n");
+    return;
+  }
+  __obj insn;
+  __decode(b->decoder,blob,n,&insn);
+  if (___isNil(insn))
+    __batchString(out,"decode failed\n");
+  else
+    b->render(insn,out);
+  __resetHeap();
+}
+
+static void __batchLines (const gdsl_batch* b, const char* p, const char* end, struct __buffer* out) {
+  while (p < end) {
+    const char* eol = memchr(p,'\n',end-p);
+    if (eol == NULL)
+      eol = end;
+    __batchLine(b,p,eol,out);
+    p = eol + 1;
+  }
+}
+
+static void* __batchThread (void* arg) {
+  struct __batchWorker* w = arg;
+  __batchLines(w->batch,w->from,w->to,&w->out);
+  __freeHeap();
+  return (NULL);
+}
+
+static const char* __nextLine (const char* p, const char* end) {
+  const char* eol = memchr(p,'\n',end-p);
+  return (eol == NULL ? end : eol + 1);
+}
+
+/* Decodes the complete lines in `[p,end)`, splitting them among the
+ * workers if there is more than one thread. */
+static void __batchBlock (struct __batchState* s, const char* p, const char* end) {
+  const gdsl_batch* b = s->batch;
+  int t, threads = b->threads;
+  if (threads <= 1) {
+    __batchLines(b,p,end,&s->out);
+    return;
+  }
+  const char* from = p;
+  for (t = 0; t < threads; t++) {
+    struct __batchWorker* w = &s->workers[t];
+    const char* to = t == threads - 1 ? end :
+      __nextLine(p + (end - p)*(t + 1)/threads,end);
+    w->batch = b;
+    w->from = from;
+    w->to = to < from ? from : to;
+    w->out.len = 0;
+    from = w->to;
+    if (pthread_create(&w->thread,NULL,__batchThread,w) != 0)
+      __fatal("pthread_create failed");
+  }
+  for (t = 0; t < threads; t++) {
+    struct __batchWorker* w = &s->workers[t];
+    pthread_join(w->thread,NULL);
+    gdsl_batch_append(&s->out,w->out.data,w->out.len);
+  }
+}
+
+/* Raw input is decoded as a stream; a mapped file is a single buffer,
+ * otherwise the buffer is refilled from the descriptor. */
+struct __batchSource {
+  int fd;
+  int failed;
+  __char* map;
+  __word size;
+  __char* buf;
+};
+
+static __char* __batchRefill (void* arg, __word* len) {
+  struct __batchSource* src = arg;
+  if (src->map != NULL) {
+    __char* map = src->map;
+    src->map = NULL;
+    src->fd = -1;
+    *len = src->size;
+    return (map);
+  }
+  while (src->fd >= 0) {
+    ssize_t r = read(src->fd,src->buf,__BATCH_BLOCK);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0) {
+      src->failed = r < 0;
+      return (NULL);
+    }
+    *len = r;
+    return (src->buf);
+  }
+  return (NULL);
+}
+
+static void __batchSweep (struct __batchState* s, struct __batchSource* src) {
+  const gdsl_batch* b = s->batch;
+  struct __stream stream;
+  char addr[32];
+  __word off, n;
+  __obj insn;
+  __streamInit(&stream,__batchRefill,src);
+  while (!s->failed && (n = __decodeStream(&stream,b->decoder,&off,&insn)) > 0) {
+    snprintf(addr,sizeof(addr),"%08zx  ",(size_t)off);
+    __batchString(&s->out,addr);
+    if (___isNil(insn))
+      __batchString(&s->out,"decode failed\n");
+    else
+      b->render(insn,&s->out);
+    __resetHeap();
+    if (s->out.len >= __BATCH_BLOCK)
+      __batchFlush(s);
+  }
+  __streamFree(&stream);
+  if (src->failed)
+    s->failed = 1;
+}
+
+/* Decodes the lines in `[p,p+sz)` and returns the number of bytes
+ * consumed; a partial last line is left for the next call unless
+ * `last`. */
+static __word __batchInput (struct __batchState* s, const char* p, __word sz, int last) {
+  const char* end = p + sz;
+  if (!last) {
+    while (end > p && end[-1] != '\n')
+      end--;
+  }
+  const char* from = p;
+  while (from < end && !s->failed) {
+    const char* to = end - from > __BATCH_BLOCK ?
+      __nextLine(from + __BATCH_BLOCK,end) : end;
+    __batchBlock(s,from,to);
+    from = to;
+    if (s->out.len >= __BATCH_BLOCK)
+      __batchFlush(s);
+  }
+  return (end - p);
+}
+
+static void __batchRead (struct __batchState* s, int in) {
+  __word cap = __BATCH_BLOCK, len = 0;
+  char* buf = malloc(cap);
+  if (buf == NULL)
+    __fatal("out of memory (batch input)");
+  int eof = 0;
+  while (!eof && !s->failed) {
+    /* fill the whole block so workers get enough lines */
+    while (len < cap) {
+      ssize_t r = read(in,buf+len,cap-len);
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0) {
+        s->failed = r < 0;
+        eof = 1;
+        break;
+      }
+      len += r;
+    }
+    __word n = __batchInput(s,buf,len,eof);
+    memmove(buf,buf+n,len-n);
+    len -= n;
+    /* a single line longer than the block */
+    if (len == cap) {
+      cap *= 2;
+      buf = realloc(buf,cap);
+      if (buf == NULL)
+        __fatal("out of memory (batch input)");
+    }
+  }
+  free(buf);
+}
+
+int gdsl_batch_run (const gdsl_batch* b, int in, int out) {
+  struct __batchState s = {0};
+  struct __batchSource src = {in};
+  struct stat st;
+  int t;
+  s.batch = b;
+  s.fd = out;
+  if (b->threads > 1) {
+    s.workers = calloc(b->threads,sizeof(struct __batchWorker));
+    if (s.workers == NULL)
+      __fatal("out of memory (batch workers)");
+  }
+  void* map = MAP_FAILED;
+  if (fstat(in,&st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    map = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,in,0);
+  if (map != MAP_FAILED)
+    madvise(map,st.st_size,MADV_SEQUENTIAL);
+  if (b->raw) {
+    if (map != MAP_FAILED) {
+      src.map = map;
+      src.size = st.st_size;
+    } else if ((src.buf = malloc(__BATCH_BLOCK)) == NULL)
+      __fatal("out of memory (batch input)");
+    __batchSweep(&s,&src);
+    free(src.buf);
+  } else if (map != MAP_FAILED)
+    __batchInput(&s,map,st.st_size,1);
+  else
+    __batchRead(&s,in);
+  if (map != MAP_FAILED)
+    munmap(map,st.st_size);
+  __batchFlush(&s);
+  if (s.workers != NULL) {
+    for (t = 0; t < b->threads; t++)
+      free(s.workers[t].out.data);
+    free(s.workers);
+  }
+  free(s.out.data);
+  return (s.failed ? -1 : 0);
+}
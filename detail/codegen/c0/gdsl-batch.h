@@ -0,0 +1,37 @@
+/* vim:ts=2:sw=2:expandtab */
+
+#ifndef __GDSL_BATCH_H
+#define __GDSL_BATCH_H
+
+#include <dis.h>
+
+/* ## Batch decoding
+ *
+ * Decodes a whole input stream in one process. The input is either hex
+ * lines (`0f 0b`, `0f0b` or `0x0f,0x0b`), one instruction of at most 32
+ * bytes per line, or raw bytes that are swept linearly. It is read in
+ * large blocks, or mapped if it is a regular file, and the output is
+ * collected in one buffer that is written in large chunks. With more
+ * than one thread the lines of each block are split among workers, each
+ * with its own implicit context; output stays in input order. Raw input
+ * is always swept by a single thread, as each instruction starts where
+ * the one before it ends.
+ *
+ * `render` appends the text for one decoded instruction to the buffer,
+ * including the final newline. Lines that do not decode (also those
+ * that end in the middle of an instruction) or are not valid hex produce
+ * an error line instead, as does a raw instruction cut off by the end of
+ * the input. */
+
+typedef struct gdsl_batch {
+  __obj (*decoder)(__obj,__obj);
+  void (*render)(__obj,struct __buffer*);
+  int threads;
+  int raw;
+} gdsl_batch;
+
+void gdsl_batch_append(struct __buffer*,const char*,__word);
+/* Returns 0 on success and -1 on an I/O error. */
+int gdsl_batch_run(const gdsl_batch*,int,int);
+
+#endif /* __GDSL_BATCH_H */
@@ -0,0 +1,226 @@
+/* vim:ts=2:sw=2:expandtab */
+
+#include "gdsl-elf.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define __ELF_HOSTDATA ELFDATA2LSB
+#else
+#define __ELF_HOSTDATA ELFDATA2MSB
+#endif
+
+/* Section and program headers are read through this common layout, so
+ * the lookups below work for both classes. */
+struct __elfSection {
+  uint32_t name;
+  uint32_t type;
+  uint64_t addr;
+  uint64_t offset;
+  uint64_t size;
+  uint32_t link;
+};
+
+struct __elfSegment {
+  uint32_t type;
+  uint32_t flags;
+  uint64_t offset;
+  uint64_t vaddr;
+  uint64_t filesz;
+};
+
+static int __elfInBounds (const gdsl_elf* e, uint64_t off, uint64_t sz) {
+  return (off <= e->size && sz <= e->size - off);
+}
+
+int gdsl_elf_open (gdsl_elf* e, const char* path) {
+  memset(e,0,sizeof(*e));
+  int fd = open(path,O_RDONLY);
+  if (fd < 0)
+    return (-1);
+  struct stat st;
+  if (fstat(fd,&st) != 0 || st.st_size < EI_NIDENT) {
+    close(fd);
+    return (-1);
+  }
+  void* map = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return (-1);
+  e->map = map;
+  e->size = st.st_size;
+  const unsigned char* id = e->map;
+  if (memcmp(id,ELFMAG,SELFMAG) != 0 ||
+      id[EI_DATA] != __ELF_HOSTDATA ||
+      (id[EI_CLASS] != ELFCLASS32 && id[EI_CLASS] != ELFCLASS64) ||
+      !__elfInBounds(e,0,id[EI_CLASS] == ELFCLASS64 ?
+                     sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr))) {
+    gdsl_elf_close(e);
+    return (-1);
+  }
+  e->is64 = id[EI_CLASS] == ELFCLASS64;
+  return (0);
+}
+
+void gdsl_elf_close (gdsl_elf* e) {
+  if (e->map != NULL)
+    munmap((void*)e->map,e->size);
+  memset(e,0,sizeof(*e));
+}
+
+static int __elfSectionAt (const gdsl_elf* e, uint64_t i, struct __elfSection* s) {
+  uint64_t off, n, entsize;
+  if (e->is64) {
+    const Elf64_Ehdr* h = (const Elf64_Ehdr*)e->map;
+    off = h->e_shoff;
+    n = h->e_shnum;
+    entsize = h->e_shentsize;
+  } else {
+    const Elf32_Ehdr* h = (const Elf32_Ehdr*)e->map;
+    off = h->e_shoff;
+    n = h->e_shnum;
+    entsize = h->e_shentsize;
+  }
+  if (off == 0)
+    return (-1);
+  /* with many sections, section 0 holds the real count */
+  if (n == 0 && i > 0) {
+    struct __elfSection first;
+    if (__elfSectionAt(e,0,&first) != 0)
+      return (-1);
+    n = first.size;
+  }
+  if ((n != 0 && i >= n) ||
+      entsize < (e->is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr)) ||
+      !__elfInBounds(e,off+i*entsize,entsize))
+    return (-1);
+  if (e->is64) {
+    const Elf64_Shdr* h = (const Elf64_Shdr*)(e->map+off+i*entsize);
+    s->name = h->sh_name;
+    s->type = h->sh_type;
+    s->addr = h->sh_addr;
+    s->offset = h->sh_offset;
+    s->size = h->sh_size;
+    s->link = h->sh_link;
+  } else {
+    const Elf32_Shdr* h = (const Elf32_Shdr*)(e->map+off+i*entsize);
+    s->name = h->sh_name;
+    s->type = h->sh_type;
+    s->addr = h->sh_addr;
+    s->offset = h->sh_offset;
+    s->size = h->sh_size;
+    s->link = h->sh_link;
+  }
+  return (0);
+}
+
+static uint64_t __elfSectionCount (const gdsl_elf* e) {
+  struct __elfSection first;
+  uint64_t n = e->is64 ?
+    ((const Elf64_Ehdr*)e->map)->e_shnum :
+    ((const Elf32_Ehdr*)e->map)->e_shnum;
+  if (n == 0 && __elfSectionAt(e,0,&first) == 0)
+    n = first.size;
+  return (n);
+}
+
+static int __elfView (const gdsl_elf* e, uint64_t off, uint64_t sz, uint64_t addr, gdsl_elf_view* v) {
+  if (!__elfInBounds(e,off,sz))
+    return (-1);
+  v->data = e->map + off;
+  v->size = sz;
+  v->addr = addr;
+  v->offset = off;
+  return (0);
+}
+
+/* Looks up the section called `name`. */
+int gdsl_elf_section (const gdsl_elf* e, const char* name, gdsl_elf_view* v) {
+  struct __elfSection strtab, s;
+  uint64_t i, n = __elfSectionCount(e);
+  uint64_t shstrndx = e->is64 ?
+    ((const Elf64_Ehdr*)e->map)->e_shstrndx :
+    ((const Elf32_Ehdr*)e->map)->e_shstrndx;
+  if (shstrndx == SHN_XINDEX) {
+    if (__elfSectionAt(e,0,&s) != 0)
+      return (-1);
+    shstrndx = s.link;
+  }
+  if (__elfSectionAt(e,shstrndx,&strtab) != 0 ||
+      !__elfInBounds(e,strtab.offset,strtab.size))
+    return (-1);
+  const char* names = (const char*)e->map + strtab.offset;
+  size_t len = strlen(name);
+  for (i = 1; i < n; i++) {
+    if (__elfSectionAt(e,i,&s) != 0)
+      return (-1);
+    if (s.name < strtab.size && len < strtab.size - s.name &&
+        memcmp(names+s.name,name,len+1) == 0) {
+      if (s.type == SHT_NOBITS)
+        return (-1);
+      return (__elfView(e,s.offset,s.size,s.addr,v));
+    }
+  }
+  return (-1);
+}
+
+static int __elfSegmentAt (const gdsl_elf* e, uint64_t i, struct __elfSegment* p) {
+  uint64_t off, n, entsize;
+  if (e->is64) {
+    const Elf64_Ehdr* h = (const Elf64_Ehdr*)e->map;
+    off = h->e_phoff;
+    n = h->e_phnum;
+    entsize = h->e_phentsize;
+  } else {
+    const Elf32_Ehdr* h = (const Elf32_Ehdr*)e->map;
+    off = h->e_phoff;
+    n = h->e_phnum;
+    entsize = h->e_phentsize;
+  }
+  if (off == 0 || i >= n ||
+      entsize < (e->is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr)) ||
+      !__elfInBounds(e,off+i*entsize,entsize))
+    return (-1);
+  if (e->is64) {
+    const Elf64_Phdr* h = (const Elf64_Phdr*)(e->map+off+i*entsize);
+    p->type = h->p_type;
+    p->flags = h->p_flags;
+    p->offset = h->p_offset;
+    p->vaddr = h->p_vaddr;
+    p->filesz = h->p_filesz;
+  } else {
+    const Elf32_Phdr* h = (const Elf32_Phdr*)(e->map+off+i*entsize);
+    p->type = h->p_type;
+    p->flags = h->p_flags;
+    p->offset = h->p_offset;
+    p->vaddr = h->p_vaddr;
+    p->filesz = h->p_filesz;
+  }
+  return (0);
+}
+
+/* Program-header mode: the `i`th executable loadable segment. */
+int gdsl_elf_segment (const gdsl_elf* e, int i, gdsl_elf_view* v) {
+  struct __elfSegment p;
+  uint64_t j;
+  for (j = 0; __elfSegmentAt(e,j,&p) == 0; j++) {
+    if (p.type != PT_LOAD || !(p.flags & PF_X))
+      continue;
+    if (i-- == 0)
+      return (__elfView(e,p.offset,p.filesz,p.vaddr,v));
+  }
+  return (-1);
+}
+
+/* `.text`, or the first executable segment if there is no such
+ * section. */
+int gdsl_elf_text (const gdsl_elf* e, gdsl_elf_view* v) {
+  if (gdsl_elf_section(e,".text",v) == 0)
+    return (0);
+  return (gdsl_elf_segment(e,0,v));
+}
@@ -0,0 +1,38 @@
+/* vim:ts=2:sw=2:expandtab */
+
+#ifndef __GDSL_ELF_H
+#define __GDSL_ELF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ## ELF section loader
+ *
+ * Maps an ELF32 or ELF64 file read-only and hands out views of its
+ * sections or segments. Views point into the mapping, so nothing is
+ * copied or allocated; they stay valid until `gdsl_elf_close`. Stripped
+ * binaries without section headers can be read through their program
+ * headers with `gdsl_elf_segment`. Only files in the byte order of the
+ * host are supported. */
+
+typedef struct gdsl_elf {
+  const unsigned char* map;
+  size_t size;
+  int is64;
+} gdsl_elf;
+
+typedef struct gdsl_elf_view {
+  const unsigned char* data;
+  size_t size;
+  uint64_t addr;
+  uint64_t offset;
+} gdsl_elf_view;
+
+/* All functions return 0 on success and -1 otherwise. */
+int gdsl_elf_open(gdsl_elf*,const char*);
+void gdsl_elf_close(gdsl_elf*);
+int gdsl_elf_section(const gdsl_elf*,const char*,gdsl_elf_view*);
+int gdsl_elf_segment(const gdsl_elf*,int,gdsl_elf_view*);
+int gdsl_elf_text(const gdsl_elf*,gdsl_elf_view*);
+
+#endif /* __GDSL_ELF_H */
@@ -2,8 +2,46 @@
 
 #include "dis.h"
 
-__unwrapped_obj heap[__RT_HEAP_SIZE] __attribute__((aligned(8)));
-__objref hp = &heap[__RT_HEAP_SIZE];
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+__thread __word* heap;
+__thread __word* hp;
+__thread __word* __heapTop;
+
+/* A decoder context owns a heap: a guard page followed by the objects.
+ * While a context is active on a thread its allocation registers live in
+ * the thread-local `heap`, `hp` and `__heapTop`; `gdsl_ctx_enter()` saves
+ * them back into the context it switches away from. The objects that
+ * survived the last collection lie in [`bottom`,`heap`); `spare` is the
+ * mapping the collector copies into next. */
+struct gdsl_ctx {
+  __word* heap;
+  __word* hp;
+  __word* top;
+  __word* bottom;
+  __char* base;
+  __char* spare;
+  size_t sz;
+  size_t guard;
+  __word request;
+  int flags;
+};
+
+/* Each thread gets an implicit context so that single-threaded clients
+ * keep working without ever creating one. */
+static __thread gdsl_ctx __threadCtx;
+static __thread gdsl_ctx* __ctx;
+
+static struct {
+  int handling;
+  struct sigaction previous;
+} __heapGuard;
 
 @fieldnames@
 
@@ -11,20 +49,14 @@ __objref hp = &heap[__RT_HEAP_SIZE];
 
 @prototypes@
 
-struct __unwrapped_immediate __unwrapped_UNIT =
+@inlinecaches@
+
+@allocsites@
+
+@constants@
+
+struct __unwrapped_immediate __STATIC_OBJ __unwrapped_UNIT =
    {.header.tag = __NIL};
-struct __unwrapped_bv __unwrapped_TRUE =
-   {.header.tag = __BV,
-    .sz = 1,
-    .vec = 1};
-struct __unwrapped_bv __unwrapped_FALSE =
-   {.header.tag = __BV,
-    .sz = 1,
-    .vec = 0};
-
-__obj __UNIT = __WRAP(&__unwrapped_UNIT);
-__obj __TRUE = __WRAP(&__unwrapped_TRUE);
-__obj __FALSE = __WRAP(&__unwrapped_FALSE);
 
 void __fatal (char *fmt, ...) {
   va_list ap;
@@ -36,10 +68,411 @@ void __fatal (char *fmt, ...) {
   abort();
 }
 
+static inline gdsl_ctx* __currentCtx () {
+  return (__ctx == NULL ? &__threadCtx : __ctx);
+}
+
+static void __heapGuardHandler (int sig, siginfo_t* info, void* uctx) {
+  __char* addr = (__char*)info->si_addr;
+  gdsl_ctx* c = __currentCtx();
+  if (c->base != NULL && addr >= c->base && addr < c->base + c->guard) {
+    static const char msg[] = "[FATAL:heap-overflow (guard page)]\n";
+    ssize_t ignored = write(2,msg,sizeof(msg)-1);
+    (void)ignored;
+    abort();
+  }
+  /* Not ours; hand the fault on to whoever was installed before us. */
+  if (__heapGuard.previous.sa_flags & SA_SIGINFO)
+    __heapGuard.previous.sa_sigaction(sig,info,uctx);
+  else if (__heapGuard.previous.sa_handler != SIG_DFL &&
+           __heapGuard.previous.sa_handler != SIG_IGN)
+    __heapGuard.previous.sa_handler(sig);
+  else {
+    signal(sig,SIG_DFL);
+    raise(sig);
+  }
+}
+
+static __word __heapSizeFromEnv () {
+  const char* s = getenv("GDSL_HEAP_SIZE");
+  if (s == NULL)
+    return (0);
+  char* end;
+  __word sz = strtoull(s,&end,0);
+  switch (*end) {
+    case 'g': case 'G': sz <<= 10; /* fall through */
+    case 'm': case 'M': sz <<= 10; /* fall through */
+    case 'k': case 'K': sz <<= 10;
+  }
+  return (sz);
+}
+
+/* Maps `sz` bytes of objects preceded by a guard page. */
+static __char* __mapSpace (size_t sz, size_t page, int flags) {
+  __char* base =
+    mmap(NULL,sz+page,PROT_READ|PROT_WRITE,
+      MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+  if (base == MAP_FAILED)
+    __fatal("unable to map heap of %zu bytes",(size_t)sz);
+  if (mprotect(base,page,PROT_NONE) != 0)
+    __fatal("unable to protect heap guard page");
+#ifdef MADV_HUGEPAGE
+  if (flags & __HEAP_HUGEPAGES)
+    madvise(base+page,sz,MADV_HUGEPAGE);
+#endif
+  return (base);
+}
+
+/* Maps a heap of `sz` bytes (or the size requested via `GDSL_HEAP_SIZE`
+ * or `__RT_HEAP_SIZE` if `sz` is zero) for the context `c`. The pages are
+ * reserved but only committed once touched, so small workloads stay
+ * small. */
+static void __mapHeap (gdsl_ctx* c, __word sz, int flags) {
+  if (sz == 0)
+    sz = __heapSizeFromEnv();
+  if (sz == 0)
+    sz = __RT_HEAP_SIZE*sizeof(__word);
+  if (getenv("GDSL_HEAP_HUGEPAGES") != NULL)
+    flags |= __HEAP_HUGEPAGES;
+  size_t page = sysconf(_SC_PAGESIZE);
+  sz = (sz + page - 1) & ~(page - 1);
+  __char* base = __mapSpace(sz,page,flags);
+  if (__sync_bool_compare_and_swap(&__heapGuard.handling,0,1)) {
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_sigaction = __heapGuardHandler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV,&sa,&__heapGuard.previous);
+  }
+  c->base = base;
+  c->sz = sz+page;
+  c->guard = page;
+  c->heap = c->bottom = (__word*)(base+page);
+  c->top = c->heap + sz/sizeof(__word);
+  c->hp = c->top;
+}
+
+static void __unmapHeap (gdsl_ctx* c) {
+  if (c->spare != NULL)
+    munmap(c->spare,c->sz);
+  c->spare = NULL;
+  if (c->base == NULL)
+    return;
+  munmap(c->base,c->sz);
+  c->base = NULL;
+  c->heap = c->hp = c->top = c->bottom = NULL;
+}
+
+static inline void __loadCtx (gdsl_ctx* c) {
+  heap = c->heap;
+  hp = c->hp;
+  __heapTop = c->top;
+}
+
+void __initHeap (__word sz, int flags) {
+  gdsl_ctx* c = __currentCtx();
+  __unmapHeap(c);
+  c->request = sz;
+  c->flags = flags;
+  __mapHeap(c,sz,flags);
+  __loadCtx(c);
+}
+
+void __freeHeap () {
+  gdsl_ctx* c = __currentCtx();
+  __unmapHeap(c);
+  __loadCtx(c);
+}
+
+gdsl_ctx* gdsl_ctx_new (__word sz, int flags) {
+  gdsl_ctx* c = calloc(1,sizeof(gdsl_ctx));
+  if (c == NULL)
+    __fatal("unable to allocate decoder context");
+  c->request = sz;
+  c->flags = flags;
+  return (c);
+}
+
+void gdsl_ctx_free (gdsl_ctx* c) {
+  if (c == NULL || c == &__threadCtx)
+    return;
+  if (c == __ctx)
+    gdsl_ctx_enter(NULL);
+  __unmapHeap(c);
+  free(c);
+}
+
+/* Makes `c` (or the thread's implicit context if `c` is NULL) the active
+ * context of the calling thread and returns the previously active one. A
+ * context must only be active on one thread at a time. */
+gdsl_ctx* gdsl_ctx_enter (gdsl_ctx* c) {
+  gdsl_ctx* prev = __currentCtx();
+  prev->hp = hp;
+  __ctx = c == &__threadCtx ? NULL : c;
+  __loadCtx(__currentCtx());
+  return (prev);
+}
+
+#ifdef WITHGC
+static __thread int __gcInhibit;
+#define __GC_INHIBIT() __gcInhibit++
+#define __GC_RELEASE() __gcInhibit--
+#else
+#define __GC_INHIBIT()
+#define __GC_RELEASE()
+#endif
+
+/* Slow path of the allocation macros: maps the heap on first use and
+ * fails cleanly if `need` objects do not fit anymore. `__CHECK_HEAP`
+ * passes `n == 0`; all live objects are rooted there, so the heap may be
+ * collected. */
+__objref __heapOverflow (__word need, __word n) {
+  gdsl_ctx* c = __currentCtx();
+  if (c->base == NULL) {
+    __mapHeap(c,c->request,c->flags);
+    __loadCtx(c);
+  }
+#ifdef WITHGC
+  ptrdiff_t reserve = (c->top - c->bottom)/4;
+  if (reserve > __GC_RESERVE)
+    reserve = __GC_RESERVE;
+  if (n == 0 && __gcInhibit == 0 && hp - heap < (ptrdiff_t)need + reserve) {
+    __gcCollect();
+    if (hp - heap < (ptrdiff_t)need + reserve)
+      __fatal("heap-overflow (%zu words live after collection of %zu)",
+        (size_t)(heap - c->bottom),(size_t)(__heapTop - c->bottom));
+  }
+#endif
+  if (hp - heap < (ptrdiff_t)need)
+    __fatal("heap-overflow (%zu words requested, %zu free of %zu)",
+      (size_t)need,(size_t)(hp - heap),(size_t)(__heapTop - heap));
+  hp -= n;
+  return ((__objref)hp);
+}
+
+/* The words an object with the tag `tag` takes, without the fields, the
+ * environment or the bytes that may follow it. */
+static inline __word __objectWords (__word tag) {
+  switch (tag) {
+    case __TAGGED: return (__WORDS(tagged));
+    case __RECORD: return (__WORDS(record));
+    case __CLOSURE: return (__WORDS(closure));
+    case __BV: return (__WORDS(bv));
+    case __INT: return (__WORDS(int));
+    case __LABEL: return (__WORDS(label));
+    case __BLOB: return (__WORDS(blob));
+    case __ROPELEAF: return (__WORDS(ropeleaf));
+    case __ROPEBRANCH: return (__WORDS(ropebranch));
+    default: return (__WORDS(immediate));
+  }
+}
+
+/* ## Garbage collection */
+
+#ifdef WITHGC
+__thread __obj** __gcStack;
+__thread __word __gcDepth;
+__thread __word __gcCapacity;
+static __thread __obj** __gcRoots;
+static __thread __word __gcRootCount;
+static __thread __word __gcRootCapacity;
+static __thread struct __gcStats __gcCounters;
+
+void __gcGrow () {
+  __word cap = __gcCapacity == 0 ? 1024 : 2*__gcCapacity;
+  __obj** stack = realloc(__gcStack,cap*sizeof(__obj*));
+  if (stack == NULL)
+    __fatal("unable to grow the shadow stack");
+  __gcStack = stack;
+  __gcCapacity = cap;
+}
+
+/* The heap being collected and the free pointer of the one it is copied
+ * into. Copies are made upwards, so the scan can follow them in order. */
+struct __gcSpace {
+  __word* from;
+  __word* top;
+  __word* free;
+};
+
+static inline int __gcInFrom (struct __gcSpace* g, void* p) {
+  return ((__word*)p >= g->from && (__word*)p < g->top);
+}
+
+/* Copies `o` unless it is immediate, outside the heap or copied already.
+ * The fields of a record, the environment of a closure and the bytes of
+ * a rope leaf are placed right behind the copy. */
+static __obj __gcCopy (struct __gcSpace* g, __obj o) {
+  if (__IMMEDIATE(o))
+    return (o);
+  __objref u = __UNWRAP(o);
+  if (!__gcInFrom(g,u))
+    return (o);
+  if (u->object.header.tag == __FORWARD)
+    return (u->forward.to);
+  __objref c = (__objref)g->free;
+  __word n = __objectWords(u->object.header.tag);
+  __word sz = u->object.header.sz;
+  memcpy(c,u,n*sizeof(__word));
+  switch (u->object.header.tag) {
+    case __RECORD:
+      c->record.fields = __FIELDS(c);
+      memcpy(c->record.fields,u->record.fields,sz*sizeof(__field));
+      n += sz*__WORDS(tagged);
+      break;
+    case __CLOSURE:
+      if (sz == 0 || __gcInFrom(g,u->closure.env)) {
+        c->closure.env = (__obj*)(g->free + n);
+        memcpy(c->closure.env,u->closure.env,sz*sizeof(__obj));
+        n += sz;
+      }
+      break;
+    case __ROPELEAF:
+      if (__gcInFrom(g,u->ropeleaf.blob)) {
+        c->ropeleaf.blob = (__char*)(g->free + n);
+        memcpy(c->ropeleaf.blob,u->ropeleaf.blob,sz);
+        n += __BYTE_WORDS(sz);
+      }
+      break;
+    default:
+      break;
+  }
+  g->free += n;
+  u->forward.header.tag = __FORWARD;
+  u->forward.to = __WRAP(c);
+  return (__WRAP(c));
+}
+
+/* Copies what the objects in [`s`,`g->free`) refer to until there is
+ * nothing left to scan. */
+static void __gcScan (struct __gcSpace* g, __word* w) {
+  __word i;
+  while (w < g->free) {
+    __objref s = (__objref)w;
+    __word sz = s->object.header.sz;
+    w += __objectWords(s->object.header.tag);
+    switch (s->object.header.tag) {
+      case __TAGGED:
+        s->tagged.payload = __gcCopy(g,s->tagged.payload);
+        break;
+      case __RECORD:
+        for (i = 0; i < sz; i++)
+          s->record.fields[i].payload =
+            __gcCopy(g,s->record.fields[i].payload);
+        w += sz*__WORDS(tagged);
+        break;
+      case __CLOSURE:
+        if (s->closure.env == (__obj*)w) {
+          for (i = 0; i < sz; i++)
+            s->closure.env[i] = __gcCopy(g,s->closure.env[i]);
+          w += sz;
+        }
+        break;
+      case __ROPEBRANCH:
+        s->ropebranch.left = __gcCopy(g,s->ropebranch.left);
+        s->ropebranch.right = __gcCopy(g,s->ropebranch.right);
+        break;
+      case __ROPELEAF:
+        if (s->ropeleaf.blob == (__char*)w)
+          w += __BYTE_WORDS(sz);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+static inline __word __gcNow () {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return ((__word)t.tv_sec*1000000000 + t.tv_nsec);
+}
+
+void __gcCollect () {
+  gdsl_ctx* c = __currentCtx();
+  if (c->base == NULL)
+    return;
+  __word i, start = __gcNow();
+  size_t sz = c->sz - c->guard;
+  if (c->spare == NULL)
+    c->spare = __mapSpace(sz,c->guard,c->flags);
+  __word* to = (__word*)(c->spare + c->guard);
+  struct __gcSpace g = {c->bottom,__heapTop,to};
+  for (i = 0; i < __gcDepth; i++)
+    *__gcStack[i] = __gcCopy(&g,*__gcStack[i]);
+  for (i = 0; i < __gcRootCount; i++)
+    *__gcRoots[i] = __gcCopy(&g,*__gcRoots[i]);
+  __gcScan(&g,to);
+  /* the old heap becomes the spare one; give its pages back */
+  __char* old = c->base;
+  madvise(old + c->guard,sz,MADV_DONTNEED);
+  c->spare = old;
+  c->base = (__char*)to - c->guard;
+  c->bottom = to;
+  c->heap = g.free;
+  c->top = to + sz/sizeof(__word);
+  c->hp = c->top;
+  __loadCtx(c);
+  struct __gcStats* st = &__gcCounters;
+  __word pause = __gcNow() - start;
+  st->collections++;
+  st->live = g.free - to;
+  st->pause = pause;
+  st->totalPause += pause;
+  if (st->live > st->maxLive)
+    st->maxLive = st->live;
+  if (pause > st->maxPause)
+    st->maxPause = pause;
+}
+
+void __gcRoot (__obj* x) {
+  if (__gcRootCount == __gcRootCapacity) {
+    __word cap = __gcRootCapacity == 0 ? 64 : 2*__gcRootCapacity;
+    __obj** roots = realloc(__gcRoots,cap*sizeof(__obj*));
+    if (roots == NULL)
+      __fatal("unable to register root");
+    __gcRoots = roots;
+    __gcRootCapacity = cap;
+  }
+  __gcRoots[__gcRootCount++] = x;
+}
+
+void __gcUnroot (__obj* x) {
+  __word i;
+  for (i = __gcRootCount; i > 0; i--)
+    if (__gcRoots[i-1] == x) {
+      __gcRoots[i-1] = __gcRoots[--__gcRootCount];
+      return;
+    }
+}
+#else
+void __gcRoot (__obj* x) {}
+void __gcUnroot (__obj* x) {}
+void __gcCollect () {}
+#endif
+
+void __getGCStats (struct __gcStats* stats) {
+#ifdef WITHGC
+  *stats = __gcCounters;
+#else
+  memset(stats,0,sizeof(*stats));
+#endif
+}
+
+__obj __printGCStats () {
+  struct __gcStats s;
+  __getGCStats(&s);
+  printf("gc: collections: %lu, live: %lu words (max %lu), pause: %lu us (max %lu us, total %lu us)\n",
+    s.collections, s.live, s.maxLive, s.pause/1000, s.maxPause/1000,
+    s.totalPause/1000);
+  return (__UNIT);
+}
+
 __obj __and (__obj A, __obj B) {
-  __word a = A->bv.vec;
-  __word b = B->bv.vec;
-  __word sz = A->bv.sz;
+  __word a = __bvVec(A);
+  __word b = __bvVec(B);
+  __word sz = __bvSize(A);
   __LOCAL0(c);
     __BV_BEGIN(c,sz);
     __BV_INIT(a & b)
@@ -48,9 +481,9 @@ __obj __and (__obj A, __obj B) {
 }
 
 __obj __or (__obj A, __obj B) {
-  __word a = A->bv.vec;
-  __word b = B->bv.vec;
-  __word sz = A->bv.sz;
+  __word a = __bvVec(A);
+  __word b = __bvVec(B);
+  __word sz = __bvSize(A);
   __LOCAL0(c);
     __BV_BEGIN(c,sz);
     __BV_INIT(a | b);
@@ -61,8 +494,8 @@ __obj __or (__obj A, __obj B) {
 /** ## Operations on integers */
 
 __obj __addi (__obj A, __obj B) {
-  __int a = A->z.value;
-  __int b = B->z.value;
+  __int a = __intValue(A);
+  __int b = __intValue(B);
   __LOCAL0(x);
     __INT_BEGIN(x);
     __INT_INIT(a + b);
@@ -71,8 +504,8 @@ __obj __addi (__obj A, __obj B) {
 }
 
 __obj __subi (__obj A, __obj B) {
-  __int a = A->z.value;
-  __int b = B->z.value;
+  __int a = __intValue(A);
+  __int b = __intValue(B);
   __LOCAL0(x);
     __INT_BEGIN(x);
     __INT_INIT(a - b);
@@ -81,8 +514,8 @@ __obj __subi (__obj A, __obj B) {
 }
 
 __obj __muli (__obj A, __obj B) {
-  __int a = A->z.value;
-  __int b = B->z.value;
+  __int a = __intValue(A);
+  __int b = __intValue(B);
   __LOCAL0(x);
     __INT_BEGIN(x);
     __INT_INIT(a * b);
@@ -91,20 +524,20 @@ __obj __muli (__obj A, __obj B) {
 }
 
 __obj __eqi (__obj A, __obj B) {
-  __int a = A->z.value;
-  __int b = B->z.value;
+  __int a = __intValue(A);
+  __int b = __intValue(B);
   return (a==b?__TRUE:__FALSE);
 }
 
 __obj __lti (__obj A, __obj B) {
-  __int a = A->z.value;
-  __int b = B->z.value;
+  __int a = __intValue(A);
+  __int b = __intValue(B);
   return (a<b?__TRUE:__FALSE);
 }
 
 __obj __lei (__obj A, __obj B) {
-  __int a = A->z.value;
-  __int b = B->z.value;
+  __int a = __intValue(A);
+  __int b = __intValue(B);
   return (a<=b?__TRUE:__FALSE);
 }
 
@@ -112,7 +545,7 @@ __obj __lei (__obj A, __obj B) {
 __obj __sx (__obj x) {
   __LOCAL0(y);
     __INT_BEGIN(y);
-    __INT_INIT(x->bv.vec);
+    __INT_INIT(__bvVec(x));
     __INT_END(y);
   return (y);
 }
@@ -121,16 +554,16 @@ __obj __sx (__obj x) {
 __obj __zx (__obj x) {
   __LOCAL0(y);
     __INT_BEGIN(y);
-    __INT_INIT(x->bv.vec);
+    __INT_INIT(__bvVec(x));
     __INT_END(y);
   return (y);
 }
 
 __obj __concat (__obj A, __obj B) {
-  __word a = A->bv.vec;
-  __word b = B->bv.vec;
-  __word szOfA = A->bv.sz;
-  __word szOfB = B->bv.sz;
+  __word a = __bvVec(A);
+  __word b = __bvVec(B);
+  __word szOfA = __bvSize(A);
+  __word szOfB = __bvSize(B);
   __word sz = szOfA + szOfB;
   __LOCAL0(x);
     __BV_BEGIN(x,sz);
@@ -139,6 +572,71 @@ __obj __concat (__obj A, __obj B) {
   return (x);
 }
 
+/* Strings produced while no `__prettyInto` is running end up in a
+ * per-thread scratch buffer. */
+__thread struct __buffer __scratch;
+static __thread struct __buffer* __output;
+
+static inline struct __buffer* __outputBuffer () {
+  return (__output == NULL ? &__scratch : __output);
+}
+
+/* Makes room for `n` more bytes and a terminating NUL. */
+static char* __reserve (struct __buffer* b, __word n) {
+  if (b->cap - b->len < n + 1) {
+    __word cap = b->cap == 0 ? 256 : b->cap;
+    while (cap - b->len < n + 1)
+      cap *= 2;
+    char* data = realloc(b->data,cap);
+    if (data == NULL)
+      __fatal("out of memory (output buffer)");
+    b->data = data;
+    b->cap = cap;
+  }
+  return (b->data + b->len);
+}
+
+static inline __obj __mkSpan (__word off, __word len) {
+  if (off > 0xffffffff || len >= ((__word)1 << 29))
+    __fatal("output buffer too large");
+  return (__IMM_SPAN(off,len));
+}
+
+/* Appends the string `o` to `b` and returns where it starts. */
+static __word __appendString (struct __buffer* b, __obj o) {
+  __word off = b->len;
+  __word len = __ropeLength(o);
+  __reserve(b,len);
+  __flattenRope(o,b->data,off,off+len);
+  b->len = off + len;
+  return (off);
+}
+
+static inline int __spanEndsAt (__obj o, __word off) {
+  return (__TAG(o) == __SPAN && __spanOffset(o) + __spanLength(o) == off);
+}
+
+#ifdef DIRECTSTRINGS
+/* Pretty printers mostly concatenate onto what they just produced, which
+ * then already sits at the end of the buffer; only the other operand
+ * needs to be copied, if at all. */
+__obj __concatstring (__obj A, __obj B) {
+  struct __buffer* b = __outputBuffer();
+  if (__TAG(B) == __SPAN && __spanEndsAt(A,__spanOffset(B)))
+    return (__mkSpan(__spanOffset(A),__spanLength(A)+__spanLength(B)));
+  __word off = __spanEndsAt(A,b->len) ? __spanOffset(A) : __appendString(b,A);
+  __appendString(b,B);
+  return (__mkSpan(off,b->len-off));
+}
+
+static __obj __showString (const char* s) {
+  struct __buffer* b = __outputBuffer();
+  __word len = strlen(s);
+  memcpy(__reserve(b,len),s,len);
+  b->len += len;
+  return (__mkSpan(b->len-len,len));
+}
+#else
 __obj __concatstring (__obj A, __obj B) {
   __LOCAL0(R);
     __ROPE_BEGIN(R);
@@ -147,45 +645,107 @@ __obj __concatstring (__obj A, __obj B) {
   return (R);
 }
 
-__obj __flattenstring(__obj o, char* buf, __word sz) {
-  switch (__TAG(o)) {
-    case __ROPELEAF: {
-      __word l = strlen(buf);
-      sz = sz - l;
-      if (sz == 0) return (__UNIT);
-      __word szz = o->ropeleaf.sz;
-      __word len = szz >= sz ? sz-1 : szz;
-      memcpy(buf+l,o->ropeleaf.blob,len);
-      buf[l+len] = '\0';
-      return (__UNIT);
-      break;
+static __obj __showString (const char* s) {
+  __LOCAL0(R);
+    __ROPE_BEGIN(R);
+    __ROPE_FROMCSTRING(s);
+    __ROPE_END(R);
+  return (R);
+}
+#endif
+
+/* Visits the leaves of a rope from right to left and returns its length.
+ * Ropes are mostly built by left-associative concatenation, so the left
+ * subtrees still to be visited are kept on an explicit stack while the
+ * walk descends to the right; the stack then stays shallow. Unless `buf`
+ * is NULL, the leaves are written back to front so that the rope ends at
+ * `end`; bytes that would land at or beyond `sz` are not written. */
+static __word __ropeWalk (__obj o, char* buf, __word end, __word sz) {
+  __obj local[64];
+  __obj* stack = local;
+  __word depth = 0, max = 64, len = 0;
+  for (;;) {
+    const char* blob = NULL;
+    __word n = 0;
+    switch (__TAG(o)) {
+      case __ROPEBRANCH:
+        if (depth == max) {
+          __obj* grown = malloc(2*max*sizeof(__obj));
+          if (grown == NULL)
+            __fatal("rope too deep");
+          memcpy(grown,stack,max*sizeof(__obj));
+          if (stack != local)
+            free(stack);
+          stack = grown;
+          max = 2*max;
+        }
+        stack[depth++] = o->ropebranch.left;
+        o = o->ropebranch.right;
+        continue;
+      case __ROPELEAF:
+        n = __HEADER(o).sz;
+        blob = (const char*)o->ropeleaf.blob;
+        break;
+      case __SPAN:
+        n = __spanLength(o);
+        blob = __outputBuffer()->data + __spanOffset(o);
+        break;
+      case __NIL:
+        break;
+      default:
+        __fatal("Object not of type {ROPE}");
     }
-    case __ROPEBRANCH: {
-      __flattenstring(o->ropebranch.left,buf,sz);
-      __flattenstring(o->ropebranch.right,buf,sz);
-      return (__UNIT);
-      break;
+    len += n;
+    if (buf != NULL && n > 0 && end - len < sz) {
+      __word at = end - len;
+      memcpy(buf+at,blob,n < sz-at ? n : sz-at);
     }
-    default:
-      __fatal("Object not of type {ROPE}");
-  };
+    if (depth == 0)
+      break;
+    o = stack[--depth];
+  }
+  if (stack != local)
+    free(stack);
+  return (len);
+}
+
+/* Writes the rope to `buf` starting at `off` and returns the offset
+ * behind it; bytes that would land at or beyond `sz` are counted but not
+ * written. */
+__word __flattenRope (__obj o, char* buf, __word off, __word sz) {
+  __word len = __ropeWalk(o,NULL,0,0);
+  if (buf != NULL && off < sz)
+    __ropeWalk(o,buf,off+len,sz);
+  return (off + len);
+}
+
+__word __ropeLength (__obj o) {
+  return (__flattenRope(o,NULL,0,0));
+}
+
+__obj __flattenstring(__obj o, char* buf, __word sz) {
+  if (sz == 0)
+    return (__UNIT);
+  __word len = __flattenRope(o,buf,0,sz-1);
+  buf[len < sz-1 ? len : sz-1] = '\0';
+  return (__UNIT);
 }
 
 __obj __equal (__obj A, __obj B) {
-  __word a = A->bv.vec;
-  __word b = B->bv.vec;
-  __word szOfA = A->bv.sz;
-  __word szOfB = B->bv.sz;
+  __word a = __bvVec(A);
+  __word b = __bvVec(B);
+  __word szOfA = __bvSize(A);
+  __word szOfB = __bvSize(B);
   __LOCAL(x, (a == b && szOfA == szOfB) ? __TRUE : __FALSE); 
   return (x);
 }
 
 __obj __not (__obj A) {
-  __word a = A->bv.vec;
-  __word sz = A->bv.sz;
+  __word a = __bvVec(A);
+  __word sz = __bvSize(A);
   __LOCAL0(x);
     __BV_BEGIN(x,sz);
-    __BV_INIT(~a & ((1 << sz)-1));
+    __BV_INIT(~a);
     __BV_END(x,sz);
   return (x);
 }
@@ -197,156 +757,132 @@ __obj __raise (__obj o) {
   return (o);
 }
 
-__obj __consume8 (__obj s) {
-  __LOCAL(blob, __RECORD_SELECT(s,___blob));
-  __char* buf = blob->blob.blob;
-  __word sz = blob->blob.sz;
-  if (sz == 0)
+/* The decoders only ever move forward through the input or step back
+ * explicitly with `unconsume`, so the stream position is kept in a
+ * mutable cursor instead of in the state record. The `__consumeTokenN`
+ * variants return the token directly; the code generator uses them
+ * whenever the (token, state) pair is only projected. */
+__thread struct __cursor __input;
+
+static __char* __streamRefill(__word);
+
+/* Set while `__runDecoder` runs a decoder: running out of input then
+ * abandons the decode instead of being fatal. `__inputCut` tells if the
+ * last decode was abandoned that way. */
+static __thread sigjmp_buf* __inputEnd;
+static __thread int __inputCut;
+
+static void __endOfInput () __attribute__((noreturn));
+static void __endOfInput () {
+  if (__inputEnd == NULL)
     __fatal("end-of-blob");
-  __char x = *buf;
-  __LOCAL0(v);
-    __BV_BEGIN(v,8);
-    __BV_INIT(x);
-    __BV_END(v,8);
-  __LOCAL0(blobb);
-    __BLOB_BEGIN(blobb);
-    __BLOB_INIT(buf+1,sz-1);
-    __BLOB_END(blobb);
-  __LOCAL0(ss);
-    __RECORD_BEGIN_UPDATE(ss,s);
-    __RECORD_UPDATE(___blob,blobb);
-    __RECORD_END_UPDATE(ss);
+  siglongjmp(*__inputEnd,1);
+}
+
+static inline __char* __consumeBytes (__word n) {
+  __char* buf = __input.cur;
+  if (__builtin_expect(__input.end - buf < (ptrdiff_t)n,0))
+    buf = __streamRefill(n);
+  __input.cur = buf + n;
+  return (buf);
+}
+
+static inline void __unconsumeBytes (__word n) {
+  if (__input.cur - __input.start < (ptrdiff_t)n)
+    __fatal("unconsume beyond start-of-blob");
+  if (__input.cur > __input.high)
+    __input.high = __input.cur;
+  __input.cur -= n;
+}
+
+static inline __obj __tokenPair (__obj v, __obj s) {
+  __ROOT(v);
+  __ROOT(s);
   __LOCAL0(a);
     __RECORD_BEGIN(a,2);
     __RECORD_ADD(___1,v);
-    __RECORD_ADD(___2,ss);
+    __RECORD_ADD(___2,s);
     __RECORD_END(a,2);
   return (a);
 }
 
-__obj __unconsume8 (__obj s) {
-  __LOCAL(blob, __RECORD_SELECT(s,___blob));
-  __char* buf = blob->blob.blob;
-  __word sz = blob->blob.sz;
-  __LOCAL0(blobb);
-    __BLOB_BEGIN(blobb);
-    __BLOB_INIT(buf-1,sz+1);
-    __BLOB_END(blobb);
-  __LOCAL0(ss);
-    __RECORD_BEGIN_UPDATE(ss,s);
-    __RECORD_UPDATE(___blob,blobb);
-    __RECORD_END_UPDATE(ss);
-  __LOCAL0(a);
-    __RECORD_BEGIN(a,2);
-    __RECORD_ADD(___1,__UNIT);
-    __RECORD_ADD(___2,ss);
-    __RECORD_END(a,2);
-  return (a);
+__obj __consumeToken8 () {
+  __char* buf = __consumeBytes(1);
+  __LOCAL0(v);
+    __BV_BEGIN(v,8);
+    __BV_INIT(buf[0]);
+    __BV_END(v,8);
+  return (v);
 }
 
-__obj __consume16 (__obj s) {
-  __LOCAL(blob, __RECORD_SELECT(s,___blob));
-  __char* buf = blob->blob.blob;
-  __word sz = blob->blob.sz;
-  if (sz < 2)
-    __fatal("end-of-blob");
+__obj __consumeToken16 () {
+  __char* buf = __consumeBytes(2);
   uint16_t x1 = buf[0];
   uint16_t x2 = buf[1]<<8;
   __LOCAL0(v);
     __BV_BEGIN(v,16);
     __BV_INIT((x1|x2)&0xffff);
     __BV_END(v,16);
-  __LOCAL0(blobb);
-    __BLOB_BEGIN(blobb);
-    __BLOB_INIT(buf+2,sz-2);
-    __BLOB_END(blobb);
-  __LOCAL0(ss);
-    __RECORD_BEGIN_UPDATE(ss,s);
-    __RECORD_UPDATE(___blob,blobb);
-    __RECORD_END_UPDATE(ss);
-  __LOCAL0(a);
-    __RECORD_BEGIN(a,2);
-    __RECORD_ADD(___1,v);
-    __RECORD_ADD(___2,ss);
-    __RECORD_END(a,2);
-  return (a);
+  return (v);
 }
 
-__obj __unconsume16 (__obj s) {
-  __LOCAL(blob, __RECORD_SELECT(s,___blob));
-  __char* buf = blob->blob.blob;
-  __word sz = blob->blob.sz;
-  __LOCAL0(blobb);
-    __BLOB_BEGIN(blobb);
-    __BLOB_INIT(buf-2,sz+2);
-    __BLOB_END(blobb);
-  __LOCAL0(ss);
-    __RECORD_BEGIN_UPDATE(ss,s);
-    __RECORD_UPDATE(___blob,blobb);
-    __RECORD_END_UPDATE(ss);
-  __LOCAL0(a);
-    __RECORD_BEGIN(a,2);
-    __RECORD_ADD(___1,__UNIT);
-    __RECORD_ADD(___2,ss);
-    __RECORD_END(a,2);
-  return (a);
-}
-
-__obj __consume32 (__obj s) {
-  __LOCAL(blob, __RECORD_SELECT(s,___blob));
-  __char* buf = blob->blob.blob;
-  __word sz = blob->blob.sz;
-  if (sz < 4)
-    __fatal("end-of-blob");
+__obj __consumeToken32 () {
+  __char* buf = __consumeBytes(4);
   uint32_t x1 = buf[0];
   uint32_t x2 = buf[1]<<8;
   uint32_t x3 = buf[2]<<16;
-  uint32_t x4 = buf[3]<<24;
+  uint32_t x4 = ((uint32_t)buf[3])<<24;
   __LOCAL0(v);
     __BV_BEGIN(v,32);
     __BV_INIT((x1|x2|x3|x4)&0xffffffff);
     __BV_END(v,32);
-  __LOCAL0(blobb);
-    __BLOB_BEGIN(blobb);
-    __BLOB_INIT(buf+2,sz-2);
-    __BLOB_END(blobb);
-  __LOCAL0(ss);
-    __RECORD_BEGIN_UPDATE(ss,s);
-    __RECORD_UPDATE(___blob,blobb);
-    __RECORD_END_UPDATE(ss);
-  __LOCAL0(a);
-    __RECORD_BEGIN(a,2);
-    __RECORD_ADD(___1,v);
-    __RECORD_ADD(___2,ss);
-    __RECORD_END(a,2);
-  return (a);
+  return (v);
+}
+
+__obj __unconsumeToken8 () {
+  __unconsumeBytes(1);
+  return (__UNIT);
+}
+
+__obj __unconsumeToken16 () {
+  __unconsumeBytes(2);
+  return (__UNIT);
+}
+
+__obj __unconsumeToken32 () {
+  __unconsumeBytes(4);
+  return (__UNIT);
+}
+
+__obj __consume8 (__obj s) {
+  return (__tokenPair(__consumeToken8(),s));
+}
+
+__obj __unconsume8 (__obj s) {
+  return (__tokenPair(__unconsumeToken8(),s));
+}
+
+__obj __consume16 (__obj s) {
+  return (__tokenPair(__consumeToken16(),s));
+}
+
+__obj __unconsume16 (__obj s) {
+  return (__tokenPair(__unconsumeToken16(),s));
+}
+
+__obj __consume32 (__obj s) {
+  return (__tokenPair(__consumeToken32(),s));
 }
 
 __obj __unconsume32 (__obj s) {
-  __LOCAL(blob, __RECORD_SELECT(s,___blob));
-  __char* buf = blob->blob.blob;
-  __word sz = blob->blob.sz;
-  __LOCAL0(blobb);
-    __BLOB_BEGIN(blobb);
-    __BLOB_INIT(buf-4,sz+4);
-    __BLOB_END(blobb);
-  __LOCAL0(ss);
-    __RECORD_BEGIN_UPDATE(ss,s);
-    __RECORD_UPDATE(___blob,blobb);
-    __RECORD_END_UPDATE(ss);
-  __LOCAL0(a);
-    __RECORD_BEGIN(a,2);
-    __RECORD_ADD(___1,__UNIT);
-    __RECORD_ADD(___2,ss);
-    __RECORD_END(a,2);
-  return (a);
+  return (__tokenPair(__unconsumeToken32(),s));
 }
 
 __obj __slice (__obj tok_, __obj offs_, __obj sz_) {
-  __word tok = tok_->bv.vec;
-  __int offs = offs_->z.value;
-  __int sz = sz_->z.value;
-  __word x = ((tok >> offs) & ((1 << sz)-1));
+  __word tok = __bvVec(tok_);
+  __int offs = __intValue(offs_);
+  __int sz = __intValue(sz_);
+  __word x = tok >> offs;
   __LOCAL0(slice);
     __BV_BEGIN(slice,sz);
     __BV_INIT(x);
@@ -358,43 +894,121 @@ __obj __halt (__obj env, __obj o) {
   return (o);
 }
 
+/* The final continuations never change, so they live in the data
+ * segment instead of being allocated on every call. */
+static __unwrapped_obj __STATIC_OBJ __haltLabel =
+   {.label = {.header.tag = __LABEL, .f = (__obj (*)(void))__halt}};
+static __obj const __haltEnv[] = {__WRAP(&__haltLabel)};
+static __unwrapped_obj __STATIC_OBJ __haltClosure =
+   {.closure = {.header = {.tag = __CLOSURE, .sz = 1}, .env = (__obj*)__haltEnv}};
+
 __obj __runWithState (__obj (*f)(__obj,__obj), __obj s) {
-  __LOCAL0(k);
-    __LABEL_BEGIN(k);
-    __LABEL_INIT(__halt);
-    __LABEL_END(k);
-  __LOCAL0(envK);
-    __CLOSURE_BEGIN(envK,1)
-    __CLOSURE_ADD(k);
-    __CLOSURE_END(envK,1);
-  return (__FCALL(f,envK,s));
+  return (__FCALL(f,__WRAP(&__haltClosure),s));
+}
+
+#ifdef WITHSTATS
+static void __countDecode(__word*);
+#endif
+
+/* Runs a decoder; a decode that runs out of input yields nil. With
+ * `WITHSTATS` its allocation goes to the heap statistics. */
+static __obj __runDecoder (__obj (*f)(__obj,__obj), __obj s) {
+  sigjmp_buf end;
+  sigjmp_buf* outer = __inputEnd;
+#ifdef WITHGC
+  __word depth = __gcDepth;
+#endif
+#ifdef WITHPROFILE
+  __word site = __allocSite;
+#endif
+#ifdef WITHSTATS
+  __word* start = hp;
+#endif
+  __obj o;
+  __inputCut = 0;
+  if (sigsetjmp(end,0) == 0) {
+    __inputEnd = &end;
+    o = __runWithState(f,s);
+  } else {
+    /* the cleanups of the abandoned frames did not run */
+#ifdef WITHGC
+    __gcDepth = depth;
+#endif
+#ifdef WITHPROFILE
+    __allocSite = site;
+#endif
+    __inputCut = 1;
+    o = __UNIT;
+  }
+  __inputEnd = outer;
+#ifdef WITHSTATS
+  __countDecode(start);
+#endif
+  return (o);
 }
 
 __obj __eval (__obj (*f)(__obj,__obj), __char* blob, __word sz) {
-  __LOCAL0(b);
-    __BLOB_BEGIN(b);
-    __BLOB_INIT(blob,sz);
-    __BLOB_END(b);
+  __input.start = __input.cur = blob;
+  __input.end = blob + sz;
   __LOCAL0(s);
-    __RECORD_BEGIN(s,1);
-    __RECORD_ADD(___blob,b);
-    __RECORD_END(s,1);
-  return (__runWithState(f,s));
+    __RECORD_BEGIN(s,0);
+    __RECORD_END(s,0);
+  return (__runDecoder(f,s));
 }
 
 __obj __evalPure (__obj (*f)(__obj,__obj), __obj x) {
   return (__runWithState(f,x));
 }
 
+/* The copying variants print into the scratch buffer and release what
+ * they used there afterwards. */
 __obj __pretty (__obj (*f)(__obj,__obj), __obj insn, char* buf, __word sz) {
+  struct __buffer* saved = __output;
+  __word mark = __scratch.len;
+  __output = &__scratch;
   __obj str = __evalPure(f,insn);
-  if (___isNil(str) || sz == 0) {
-    return (str);
-  } else {
-    buf[0] = '\0';
+  if (!___isNil(str) && sz > 0)
     __flattenstring(str,buf,sz);
-    return (str);
+  __output = saved;
+  __scratch.len = mark;
+  return (str);
+}
+
+/* Like `snprintf`: writes at most `sz` bytes including the terminating
+ * NUL and returns the length of the whole output. */
+__word __prettyTo (__obj (*f)(__obj,__obj), __obj insn, char* buf, __word sz) {
+  struct __buffer* saved = __output;
+  __word mark = __scratch.len;
+  __output = &__scratch;
+  __obj str = __evalPure(f,insn);
+  __word len = ___isNil(str) ? 0 : __flattenRope(str,buf,0,sz == 0 ? 0 : sz-1);
+  if (sz > 0)
+    buf[len < sz-1 ? len : sz-1] = '\0';
+  __output = saved;
+  __scratch.len = mark;
+  return (len);
+}
+
+__word __prettyInto (__obj (*f)(__obj,__obj), __obj insn, struct __buffer* out) {
+  struct __buffer* saved = __output;
+  __word start = out->len;
+  __output = out;
+  __obj str = __evalPure(f,insn);
+  __word off = start, len = 0;
+  if (__TAG(str) == __SPAN) {
+    off = __spanOffset(str);
+    len = __spanLength(str);
+  } else if (!___isNil(str)) {
+    off = __appendString(out,str);
+    len = out->len - off;
   }
+  /* drop the intermediate strings in front of the result */
+  __reserve(out,0);
+  memmove(out->data+start,out->data+off,len);
+  out->len = start + len;
+  out->data[out->len] = '\0';
+  __output = saved;
+  return (len);
 }
 
 /* Caller needs to reset the heap with `__resetHeap()` */
@@ -405,36 +1019,1025 @@ __word __decode (__obj (*f)(__obj,__obj), __char* blob, __word sz, __obj* insn)
     return (0);
   } else {
     __obj i = __RECORD_SELECT(o,___1);
-    __obj s = __RECORD_SELECT(o,___2);
-    __obj blobb = __RECORD_SELECT(s,___blob);
-    __word consumed = sz - blobb->blob.sz;
+    __word consumed = __input.cur - blob;
     *insn = i;
     return (consumed);
   }
 }
 
-__obj __cont (__obj env, __obj f) {
-  __LOCAL(s,__CLOSURE_REF(env,1));
-  __LOCAL0(k);
-    __LABEL_BEGIN(k);
-    __LABEL_INIT(__halt);
-    __LABEL_END(k);
-  __LOCAL0(envK);
-    __CLOSURE_BEGIN(envK,1)
-    __CLOSURE_ADD(k);
-    __CLOSURE_END(envK,1);
-  __LOCAL(ff,__CLOSURE_REF(f,0));
-  return (__INVOKE3(ff,f,envK,s));
+/* For the `length-only` variants of a decoder (e.g. `__decode_length__`),
+ * which do not build a result; returns 0 if nothing could be decoded.
+ * Caller needs to reset the heap with `__resetHeap()` */
+__word __decodeLength (__obj (*f)(__obj,__obj), __char* blob, __word sz) {
+  __obj o = __eval(f,blob,sz);
+  if (___isNil(o))
+    return (0);
+  return (__input.cur - blob);
+}
+
+/* Decodes instructions from `blob` back to back into `out` and returns
+ * the number of entries written; the sweep continues at the end of the
+ * last entry. The heap is reset on entry, so the instructions stay valid
+ * until the next call. An instruction cut off by the end of `blob` comes
+ * back as nil entries of one byte each. A call stops early once three
+ * quarters of the heap are in use, but always makes progress. */
+__word __decodeMany (__obj (*f)(__obj,__obj), __char* blob, __word sz, struct __decoded* out, __word n) {
+  __word i;
+  __resetHeap();
+  __input.start = __input.cur = blob;
+  __input.end = blob + sz;
+  __LOCAL0(s);
+    __RECORD_BEGIN(s,0);
+    __RECORD_END(s,0);
+  ptrdiff_t reserve = (__heapTop - heap)/4;
+  __GC_INHIBIT();
+  for (i = 0; i < n && __input.cur < __input.end; i++) {
+    if (i > 0 && hp - heap < reserve)
+      break;
+    __char* start = __input.cur;
+    __obj o = __runDecoder(f,s);
+    out[i].offset = start - blob;
+    if (___isNil(o) || __input.cur <= start) {
+      out[i].insn = __UNIT;
+      __input.cur = start + 1;
+    } else
+      out[i].insn = __RECORD_SELECT(o,___1);
+    out[i].length = __input.cur - start;
+  }
+  __GC_RELEASE();
+  return (i);
+}
+
+void __streamInit (struct __stream* s, __char* (*refill)(void*,__word*), void* arg) {
+  memset(s,0,sizeof(*s));
+  s->refill = refill;
+  s->arg = arg;
+}
+
+void __streamFree (struct __stream* s) {
+  free(s->stage);
+  s->stage = NULL;
+  s->stageLen = s->stageCap = 0;
+}
+
+static void __streamReserve (struct __stream* s, __word n) {
+  if (s->stageCap >= n)
+    return;
+  __word cap = s->stageCap == 0 ? 64 : s->stageCap;
+  while (cap < n)
+    cap *= 2;
+  __char* stage = realloc(s->stage,cap);
+  if (stage == NULL)
+    __fatal("out of memory (stream staging)");
+  s->stage = stage;
+  s->stageCap = cap;
+}
+
+/* Called when fewer than `n` bytes are left at the cursor. The current
+ * instruction is moved into the staging area and as many bytes of the
+ * following buffers as needed are appended. If the stream ends first,
+ * the staging area holds all that is left and the decode is abandoned. */
+static __char* __streamRefill (__word n) {
+  struct __stream* s = __input.stream;
+  if (s == NULL)
+    __endOfInput();
+  ptrdiff_t cur = __input.cur - __input.start;
+  ptrdiff_t high = __input.high - __input.start;
+  if (!s->staged) {
+    __word k = __input.end - __input.start;
+    __streamReserve(s,k+n);
+    memcpy(s->stage,__input.start,k);
+    s->stageLen = k;
+    s->lo = 0;
+    s->delta = __input.start - s->chunk;
+    s->taken = s->len;
+    s->staged = 1;
+  } else {
+    ptrdiff_t drop = __input.start - s->stage;
+    memmove(s->stage,__input.start,s->stageLen-drop);
+    s->stageLen -= drop;
+    s->lo -= drop;
+    s->delta += drop;
+  }
+  while (s->stageLen - cur < n) {
+    if (s->taken == s->len) {
+      __word len;
+      __char* chunk = s->refill(s->arg,&len);
+      if (chunk == NULL) {
+        s->eof = 1;
+        break;
+      }
+      s->chunk = chunk;
+      s->len = len;
+      s->taken = 0;
+      s->lo = s->stageLen;
+      s->delta = -(ptrdiff_t)s->stageLen;
+    }
+    __word k = n - (s->stageLen - cur);
+    if (k > s->len - s->taken)
+      k = s->len - s->taken;
+    __streamReserve(s,s->stageLen+k);
+    memcpy(s->stage+s->stageLen,s->chunk+s->taken,k);
+    s->stageLen += k;
+    s->taken += k;
+  }
+  __input.start = s->stage;
+  __input.cur = s->stage + cur;
+  __input.high = s->stage + (high > cur ? high : cur);
+  __input.end = s->stage + s->stageLen;
+  if (s->eof)
+    __endOfInput();
+  return (__input.cur);
+}
+
+/* Moves to the next instruction: back from the staging area into the
+ * buffer once past the staged bytes of older buffers, or on to the next
+ * buffer. Returns 0 at the end of the stream. */
+static int __streamNext (struct __stream* s) {
+  if (s->eof)
+    return (0);
+  if (s->staged) {
+    ptrdiff_t i = s->next - s->stage;
+    if (i >= s->lo) {
+      s->staged = 0;
+      s->next = s->chunk + i + s->delta;
+    }
+  }
+  while (!s->staged && (s->next == NULL || s->next == s->chunk + s->len)) {
+    __word len;
+    __char* chunk = s->refill(s->arg,&len);
+    if (chunk == NULL)
+      return (0);
+    s->chunk = s->next = chunk;
+    s->len = len;
+  }
+  __input.start = __input.cur = __input.high = s->next;
+  __input.end = s->staged ? s->stage + s->stageLen : s->chunk + s->len;
+  return (1);
+}
+
+__word __decodeStream (struct __stream* s, __obj (*f)(__obj,__obj), __word* offset, __obj* insn) {
+  if (!__streamNext(s))
+    return (0);
+  __word length;
+  __input.stream = s;
+  __LOCAL0(st);
+    __RECORD_BEGIN(st,0);
+    __RECORD_END(st,0);
+  __obj o = __runDecoder(f,st);
+  __input.stream = NULL;
+  if (s->eof) {
+    /* cut off by the end of the stream */
+    *insn = __UNIT;
+    length = __input.end - __input.start;
+  } else if (___isNil(o) || __input.cur <= __input.start) {
+    *insn = __UNIT;
+    length = 1;
+  } else {
+    *insn = __RECORD_SELECT(o,___1);
+    length = __input.cur - __input.start;
+  }
+  s->next = __input.start + length;
+  *offset = s->offset;
+  s->offset += length;
+  return (length);
+}
+
+/* Decodes at every offset in [`from`,`to`) of `blob`; the entry of offset
+ * `from+i` goes to `out[i]`. Instructions may extend up to the end of
+ * `blob`, so a buffer can be split into chunks for several threads; one
+ * that would extend past it is an entry of length 0. The
+ * heap is reset on entry and a call stops early once three quarters of
+ * it are in use, but always makes progress. */
+__word __decodeSuperset (__obj (*f)(__obj,__obj), __char* blob, __word sz, __word from, __word to, struct __decoded* out) {
+  __word i;
+  __resetHeap();
+  __input.start = blob;
+  __input.end = blob + sz;
+  __LOCAL0(s);
+    __RECORD_BEGIN(s,0);
+    __RECORD_END(s,0);
+  ptrdiff_t reserve = (__heapTop - heap)/4;
+  __GC_INHIBIT();
+  for (i = 0; from + i < to && from + i < sz; i++) {
+    if (i > 0 && hp - heap < reserve)
+      break;
+    __char* start = blob + from + i;
+    __input.cur = start;
+    __obj o = __runDecoder(f,s);
+    out[i].offset = from + i;
+    if (___isNil(o) || __input.cur <= start) {
+      out[i].insn = __UNIT;
+      out[i].length = 0;
+    } else {
+      out[i].insn = __RECORD_SELECT(o,___1);
+      out[i].length = __input.cur - start;
+    }
+  }
+  __GC_RELEASE();
+  return (i);
+}
+
+/* ## Parallel linear sweep
+ *
+ * Every worker sweeps its own chunk, starting at the chunk's first byte,
+ * and runs on past the chunk's end to finish its last instruction. Such
+ * a start may well be in the middle of an instruction, so the chunks are
+ * stitched together afterwards: starting where the previous chunk really
+ * ended, instructions are decoded again until they meet the worker's
+ * stream, which is correct from there on. Chunks start at multiples of
+ * 64 bytes, so no two workers share a word of the bitmaps. */
+
+#define __SWEEP_BATCH 256
+
+struct __sweepChunk {
+  pthread_t thread;
+  __obj (*f)(__obj,__obj);
+  __char* blob;
+  __word sz;
+  __word from;
+  __word to;
+  __word end;
+  uint64_t* starts;
+  uint64_t* invalid;
+};
+
+static inline int __bitTest (uint64_t* bits, __word i) {
+  return ((bits[i/64] >> (i%64)) & 1);
+}
+
+static inline void __bitSet (uint64_t* bits, __word i, int v) {
+  if (v)
+    bits[i/64] |= (uint64_t)1 << (i%64);
+  else
+    bits[i/64] &= ~((uint64_t)1 << (i%64));
+}
+
+/* Records the entries of a sweep from `*pos` while it is below `to` and
+ * advances `*pos` past them. */
+static void __sweepRange (__obj (*f)(__obj,__obj), __char* blob, __word sz, __word* pos, __word to, uint64_t* starts, uint64_t* invalid, struct __decoded* out) {
+  while (*pos < to) {
+    __word i, k = __decodeMany(f,blob+*pos,sz-*pos,out,__SWEEP_BATCH);
+    for (i = 0; i < k && *pos < to; i++) {
+      __bitSet(starts,*pos,1);
+      if (invalid != NULL)
+        __bitSet(invalid,*pos,___isNil(out[i].insn));
+      *pos += out[i].length;
+    }
+  }
+}
+
+static void __sweepRun (struct __sweepChunk* c) {
+  struct __decoded out[__SWEEP_BATCH];
+  __word pos = c->from;
+  __sweepRange(c->f,c->blob,c->sz,&pos,c->to,c->starts,c->invalid,out);
+  c->end = pos;
+}
+
+static void* __sweepThread (void* arg) {
+  __sweepRun(arg);
+  __freeHeap();
+  return (NULL);
+}
+
+/* Stitches chunk `c` to the stream of its predecessor, which ended at
+ * `pos`, and returns where the stream of `c` really ends. */
+static __word __sweepStitch (struct __sweepChunk* c, __word pos) {
+  struct __decoded out;
+  __word i;
+  for (i = c->from; i < pos && i < c->to; i++) {
+    __bitSet(c->starts,i,0);
+    if (c->invalid != NULL)
+      __bitSet(c->invalid,i,0);
+  }
+  while (pos < c->to) {
+    if (__bitTest(c->starts,pos))
+      return (c->end);
+    __decodeMany(c->f,c->blob+pos,c->sz-pos,&out,1);
+    __bitSet(c->starts,pos,1);
+    if (c->invalid != NULL)
+      __bitSet(c->invalid,pos,___isNil(out.insn));
+    for (i = pos + 1; i < pos + out.length && i < c->to; i++) {
+      __bitSet(c->starts,i,0);
+      if (c->invalid != NULL)
+        __bitSet(c->invalid,i,0);
+    }
+    pos += out.length;
+  }
+  return (pos);
+}
+
+/* Sweeps `blob` linearly on up to `threads` threads, each with its own
+ * implicit context, and returns the number of entries. Bit `i` of
+ * `starts` is set if an entry starts at offset `i` and, if `invalid` is
+ * not NULL, bit `i` of `invalid` if that entry is an undecodable byte.
+ * Both bitmaps need room for `sz` bits; the result is the same as that
+ * of a sequential `__decodeMany` sweep. The heap of the calling thread
+ * is reset. */
+__word __sweepParallel (__obj (*f)(__obj,__obj), __char* blob, __word sz, int threads, uint64_t* starts, uint64_t* invalid) {
+  __word i, words = (sz + 63)/64;
+  memset(starts,0,words*sizeof(uint64_t));
+  if (invalid != NULL)
+    memset(invalid,0,words*sizeof(uint64_t));
+  if (threads < 1)
+    threads = 1;
+  __word per = ((sz + threads - 1)/threads + 63) & ~(__word)63;
+  if (per < 4096)
+    per = 4096;
+  __word n = (sz + per - 1)/per;
+  if (n == 0)
+    return (0);
+  struct __sweepChunk* chunks = calloc(n,sizeof(struct __sweepChunk));
+  if (chunks == NULL)
+    __fatal("unable to allocate sweep chunks");
+  for (i = 0; i < n; i++) {
+    struct __sweepChunk* c = &chunks[i];
+    c->f = f;
+    c->blob = blob;
+    c->sz = sz;
+    c->from = i*per;
+    c->to = c->from + per < sz ? c->from + per : sz;
+    c->starts = starts;
+    c->invalid = invalid;
+    if (i > 0 && pthread_create(&c->thread,NULL,__sweepThread,c) != 0)
+      __fatal("unable to start sweep thread");
+  }
+  __sweepRun(&chunks[0]);
+  for (i = 1; i < n; i++)
+    pthread_join(chunks[i].thread,NULL);
+  __word pos = chunks[0].end;
+  for (i = 1; i < n; i++)
+    pos = __sweepStitch(&chunks[i],pos);
+  free(chunks);
+  __word count = 0;
+  for (i = 0; i < words; i++)
+    count += __builtin_popcountll(starts[i]);
+  return (count);
+}
+
+/* ## Pipelines
+ *
+ * Stages are connected by bounded single-producer single-consumer rings
+ * of batches. A fixed number of batches circulates: the last stage hands
+ * them back to the decoder through one more ring, so a slow stage holds
+ * up the ones before it instead of letting batches pile up. A batch with
+ * no instructions marks the end of the input. */
+
+struct __ring {
+  struct __batch** slots;
+  __word mask;
+  __word head __attribute__((aligned(64)));
+  __word tail __attribute__((aligned(64)));
+};
+
+static void __ringInit (struct __ring* r, __word n) {
+  __word cap = 1;
+  while (cap < n)
+    cap *= 2;
+  r->slots = calloc(cap,sizeof(struct __batch*));
+  if (r->slots == NULL)
+    __fatal("unable to allocate pipeline ring");
+  r->mask = cap - 1;
+  r->head = r->tail = 0;
+}
+
+static int __ringPush (struct __ring* r, struct __batch* b) {
+  __word tail = __atomic_load_n(&r->tail,__ATOMIC_RELAXED);
+  if (tail - __atomic_load_n(&r->head,__ATOMIC_ACQUIRE) > r->mask)
+    return (0);
+  r->slots[tail & r->mask] = b;
+  __atomic_store_n(&r->tail,tail+1,__ATOMIC_RELEASE);
+  return (1);
+}
+
+static struct __batch* __ringPop (struct __ring* r) {
+  __word head = __atomic_load_n(&r->head,__ATOMIC_RELAXED);
+  if (head == __atomic_load_n(&r->tail,__ATOMIC_ACQUIRE))
+    return (NULL);
+  struct __batch* b = r->slots[head & r->mask];
+  __atomic_store_n(&r->head,head+1,__ATOMIC_RELEASE);
+  return (b);
+}
+
+static void __ringSend (struct __ring* r, struct __batch* b, struct __pipelineStats* st) {
+  if (__ringPush(r,b))
+    return;
+  st->stalls++;
+  while (!__ringPush(r,b))
+    sched_yield();
+}
+
+static struct __batch* __ringReceive (struct __ring* r, struct __pipelineStats* st) {
+  struct __batch* b = __ringPop(r);
+  if (b != NULL)
+    return (b);
+  st->starved++;
+  while ((b = __ringPop(r)) == NULL)
+    sched_yield();
+  return (b);
+}
+
+struct __pipelineStage {
+  pthread_t thread;
+  struct __stage stage;
+  struct __ring* in;
+  struct __ring* out;
+  struct __pipelineStats* stats;
+};
+
+static void* __pipelineThread (void* arg) {
+  struct __pipelineStage* p = arg;
+  for (;;) {
+    struct __batch* b = __ringReceive(p->in,p->stats);
+    if (b->n > 0) {
+      gdsl_ctx* prev = gdsl_ctx_enter(b->ctx);
+      __GC_INHIBIT();
+      p->stage.run(b,p->stage.arg);
+      __GC_RELEASE();
+      gdsl_ctx_enter(prev);
+      p->stats->batches++;
+      p->stats->items += b->n;
+    }
+    __ringSend(p->out,b,p->stats);
+    if (b->n == 0)
+      return (NULL);
+  }
+}
+
+/* Decodes `blob` in batches of up to `batchSize` (at least 1)
+ * instructions on the calling thread and runs the stages on one thread
+ * each. Every batch comes with a context of its own; a stage runs with
+ * the batch's context entered, so what it allocates travels with the batch, and
+ * `values` holds one object per instruction for the stages to pass on.
+ * `stats`, if given, receives `n+1` entries: the decoder's, then the
+ * stages'. Returns the number of instructions decoded. */
+__word __pipeline (__obj (*f)(__obj,__obj), __char* blob, __word sz, struct __stage* stages, int n, __word batchSize, struct __pipelineStats* stats) {
+  int i, batches = 2*(n + 1);
+  if (batchSize == 0)
+    __fatal("pipeline batch size must not be 0");
+  struct __pipelineStats* st = calloc(n+1,sizeof(struct __pipelineStats));
+  struct __ring* rings = calloc(n+1,sizeof(struct __ring));
+  struct __pipelineStage* threads = calloc(n,sizeof(struct __pipelineStage));
+  struct __batch* pool = calloc(batches,sizeof(struct __batch));
+  if (st == NULL || rings == NULL || threads == NULL || pool == NULL)
+    __fatal("unable to allocate pipeline");
+  /* ring 0 returns batches to the decoder and holds all of them at
+   * first; the others bound how far a stage can run ahead */
+  for (i = 0; i <= n; i++)
+    __ringInit(&rings[i],i == 0 ? batches : 2);
+  for (i = 0; i < batches; i++) {
+    struct __batch* b = &pool[i];
+    b->ctx = gdsl_ctx_new(0,0);
+    b->insns = malloc(batchSize*sizeof(struct __decoded));
+    b->values = calloc(batchSize,sizeof(__obj));
+    if (b->insns == NULL || b->values == NULL)
+      __fatal("unable to allocate pipeline batch");
+    __ringPush(&rings[0],b);
+  }
+  for (i = 0; i < n; i++) {
+    struct __pipelineStage* p = &threads[i];
+    p->stage = stages[i];
+    p->in = &rings[i+1];
+    p->out = &rings[(i+2) % (n+1)];
+    p->stats = &st[i+1];
+    if (pthread_create(&p->thread,NULL,__pipelineThread,p) != 0)
+      __fatal("unable to start pipeline thread");
+  }
+  __word off = 0, total = 0;
+  struct __ring* out = n > 0 ? &rings[1] : &rings[0];
+  for (;;) {
+    struct __batch* b = __ringReceive(&rings[0],&st[0]);
+    b->offset = off;
+    b->n = 0;
+    if (off < sz) {
+      gdsl_ctx* prev = gdsl_ctx_enter(b->ctx);
+      b->n = __decodeMany(f,blob+off,sz-off,b->insns,batchSize);
+      gdsl_ctx_enter(prev);
+      __word j;
+      for (j = 0; j < b->n; j++)
+        b->insns[j].offset += off;
+      if (b->n > 0) {
+        struct __decoded* last = &b->insns[b->n-1];
+        __word next = last->offset + last->length;
+        /* a batch that makes no progress is the last one */
+        off = next > off ? next : sz;
+        st[0].batches++;
+        st[0].items += b->n;
+        total += b->n;
+      }
+    }
+    __ringSend(out,b,&st[0]);
+    if (b->n == 0)
+      break;
+  }
+  for (i = 0; i < n; i++)
+    pthread_join(threads[i].thread,NULL);
+  for (i = 0; i < batches; i++) {
+    gdsl_ctx_free(pool[i].ctx);
+    free(pool[i].insns);
+    free(pool[i].values);
+  }
+  for (i = 0; i <= n; i++)
+    free(rings[i].slots);
+  if (stats != NULL)
+    memcpy(stats,st,(n+1)*sizeof(struct __pipelineStats));
+  free(st);
+  free(rings);
+  free(threads);
+  free(pool);
+  return (total);
+}
+
+__obj __printPipelineStats (struct __pipelineStats* stats, int n) {
+  int i;
+  for (i = 0; i <= n; i++) {
+    struct __pipelineStats* s = &stats[i];
+    printf("stage %d: batches: %lu, items: %lu, stalls: %lu, starved: %lu\n",
+      i, s->batches, s->items, s->stalls, s->starved);
+  }
+  return (__UNIT);
+}
+
+/* ## Decode and translation caches */
+
+#define __CACHE_KEY_MAX 32
+
+struct __cacheEntry {
+  struct __cacheEntry* next;
+  struct __cacheEntry* newer;
+  struct __cacheEntry* older;
+  __obj (*f)(__obj,__obj);
+  __word hash;
+  __word length;
+  __obj value;
+  void* objects;
+  __word keylen;
+  __char key[];
+};
+
+struct __cache {
+  __word capacity;
+  __word mask;
+  struct __cacheEntry** buckets;
+  struct __cacheEntry* newest;
+  struct __cacheEntry* oldest;
+  struct __cacheStats stats;
+};
+
+static __word __cacheHash (__char* p, __word n) {
+  __word i, h = 14695981039346656037ull ^ n;
+  for (i = 0; i < n; i++)
+    h = (h ^ p[i])*1099511628211ull;
+  return (h);
+}
+
+extern const char __start_gdsl_static[];
+extern const char __stop_gdsl_static[];
+
+static inline int __isStatic (__objref u) {
+  return ((const char*)u >= __start_gdsl_static &&
+          (const char*)u < __stop_gdsl_static);
+}
+
+/* The size of the copy of `o` that `__persist` makes. */
+static __word __persistSize (__obj o) {
+  if (__IMMEDIATE(o))
+    return (0);
+  __objref u = __UNWRAP(o);
+  if (__isStatic(u))
+    return (0);
+  __word i, sz = u->object.header.sz;
+  __word n = __objectWords(u->object.header.tag)*sizeof(__word);
+  switch (u->object.header.tag) {
+    case __TAGGED:
+      return (n + __persistSize(u->tagged.payload));
+    case __RECORD:
+      n += sz*sizeof(__field);
+      for (i = 0; i < sz; i++)
+        n += __persistSize(u->record.fields[i].payload);
+      return (n);
+    case __CLOSURE:
+      n += sz*sizeof(__obj);
+      for (i = 0; i < sz; i++)
+        n += __persistSize(u->closure.env[i]);
+      return (n);
+    case __ROPEBRANCH:
+      return (n +
+              __persistSize(u->ropebranch.left) +
+              __persistSize(u->ropebranch.right));
+    case __ROPELEAF:
+      return (n + __BYTE_WORDS(sz)*sizeof(__word));
+    default:
+      return (n);
+  }
+}
+
+/* Copies the objects reachable from `o` to `*mem`, which must have room
+ * for `__persistSize(o)` bytes, and advances `*mem`. Only immediates and
+ * static objects are shared; objects of other persistent copies (say, an
+ * instruction from `__decodeCached`) are copied as well, since these go
+ * away with their cache entry. */
+static __obj __persist (__obj o, __char** mem) {
+  if (__IMMEDIATE(o))
+    return (o);
+  __objref u = __UNWRAP(o);
+  if (__isStatic(u))
+    return (o);
+  __objref c = (__objref)*mem;
+  __word i, sz = u->object.header.sz;
+  __word n = __objectWords(u->object.header.tag)*sizeof(__word);
+  memcpy(c,u,n);
+  *mem += n;
+  switch (u->object.header.tag) {
+    case __TAGGED:
+      c->tagged.payload = __persist(u->tagged.payload,mem);
+      break;
+    case __RECORD:
+      c->record.fields = (__field*)*mem;
+      *mem += sz*sizeof(__field);
+      for (i = 0; i < sz; i++) {
+        c->record.fields[i] = u->record.fields[i];
+        c->record.fields[i].payload =
+          __persist(u->record.fields[i].payload,mem);
+      }
+      break;
+    case __CLOSURE:
+      c->closure.env = (__obj*)*mem;
+      *mem += sz*sizeof(__obj);
+      for (i = 0; i < sz; i++)
+        c->closure.env[i] = __persist(u->closure.env[i],mem);
+      break;
+    case __ROPEBRANCH:
+      c->ropebranch.left = __persist(u->ropebranch.left,mem);
+      c->ropebranch.right = __persist(u->ropebranch.right,mem);
+      break;
+    case __ROPELEAF:
+      c->ropeleaf.blob = (__char*)*mem;
+      *mem += __BYTE_WORDS(sz)*sizeof(__word);
+      memcpy(c->ropeleaf.blob,u->ropeleaf.blob,sz);
+      break;
+    default:
+      break;
+  }
+  return (__WRAP(c));
+}
+
+struct __cache* __cacheNew (__word capacity) {
+  struct __cache* c = calloc(1,sizeof(struct __cache));
+  if (c == NULL)
+    __fatal("unable to allocate cache");
+  if (capacity == 0)
+    capacity = 1;
+  __word n = 1;
+  while (n < 2*capacity)
+    n <<= 1;
+  c->buckets = calloc(n,sizeof(struct __cacheEntry*));
+  if (c->buckets == NULL)
+    __fatal("unable to allocate cache");
+  c->capacity = capacity;
+  c->mask = n - 1;
+  return (c);
 }
 
+static void __cacheUnlink (struct __cache* c, struct __cacheEntry* e) {
+  if (e->newer != NULL)
+    e->newer->older = e->older;
+  else
+    c->newest = e->older;
+  if (e->older != NULL)
+    e->older->newer = e->newer;
+  else
+    c->oldest = e->newer;
+}
+
+static void __cachePushNewest (struct __cache* c, struct __cacheEntry* e) {
+  e->newer = NULL;
+  e->older = c->newest;
+  if (c->newest != NULL)
+    c->newest->newer = e;
+  else
+    c->oldest = e;
+  c->newest = e;
+}
+
+static void __cacheTouch (struct __cache* c, struct __cacheEntry* e) {
+  c->stats.hits++;
+  __cacheUnlink(c,e);
+  __cachePushNewest(c,e);
+}
+
+static void __cacheRemove (struct __cache* c, struct __cacheEntry* e) {
+  struct __cacheEntry** p = &c->buckets[e->hash & c->mask];
+  while (*p != e)
+    p = &(*p)->next;
+  *p = e->next;
+  __cacheUnlink(c,e);
+  free(e->objects);
+  free(e);
+  c->stats.entries--;
+}
+
+static void __cacheEvict (struct __cache* c) {
+  __cacheRemove(c,c->oldest);
+  c->stats.evictions++;
+}
+
+/* Drops all entries; the values handed out so far become invalid. */
+void __cacheClear (struct __cache* c) {
+  while (c->oldest != NULL)
+    __cacheEvict(c);
+}
+
+/* Changes the number of entries `c` keeps, evicting the least recently
+ * used ones if there are too many. */
+void __cacheSetCapacity (struct __cache* c, __word capacity) {
+  c->capacity = capacity == 0 ? 1 : capacity;
+  while (c->stats.entries > c->capacity)
+    __cacheEvict(c);
+}
+
+void __cacheFree (struct __cache* c) {
+  if (c == NULL)
+    return;
+  __cacheClear(c);
+  free(c->buckets);
+  free(c);
+}
+
+/* Adds a persistent copy of `value` under the given key. The bucket
+ * chains never grow beyond the capacity, so the table is not resized. */
+static struct __cacheEntry* __cacheInsert (struct __cache* c, __obj (*f)(__obj,__obj), __word hash, __char* key, __word keylen, __obj value, __word length) {
+  struct __cacheEntry* e = malloc(sizeof(struct __cacheEntry) + keylen);
+  __word n = __persistSize(value);
+  void* objects = n == 0 ? NULL : malloc(n);
+  if (e == NULL || (n > 0 && objects == NULL))
+    __fatal("out of memory (cache)");
+  __char* mem = objects;
+  e->value = __persist(value,&mem);
+  e->objects = objects;
+  e->length = length;
+  e->f = f;
+  e->hash = hash;
+  e->keylen = keylen;
+  memcpy(e->key,key,keylen);
+  if (c->stats.entries >= c->capacity)
+    __cacheEvict(c);
+  struct __cacheEntry** b = &c->buckets[hash & c->mask];
+  e->next = *b;
+  *b = e;
+  __cachePushNewest(c,e);
+  c->stats.entries++;
+  return (e);
+}
+
+static struct __cacheEntry* __cacheFindKey (struct __cache* c, __obj (*f)(__obj,__obj), __word h, __char* key, __word keylen) {
+  struct __cacheEntry* e;
+  for (e = c->buckets[h & c->mask]; e != NULL; e = e->next)
+    if (e->hash == h && e->f == f && e->keylen == keylen &&
+        memcmp(e->key,key,keylen) == 0)
+      return (e);
+  return (NULL);
+}
+
+/* Decodes are keyed by the bytes read. Keys of four bytes or more are
+ * hashed by their first four bytes, so a lookup needs at most four
+ * probes without knowing the key length. */
+static struct __cacheEntry* __cacheFindBytes (struct __cache* c, __obj (*f)(__obj,__obj), __char* blob, __word sz) {
+  __word n;
+  for (n = sz < 4 ? sz : 4; n > 0; n--) {
+    __word h = __cacheHash(blob,n);
+    struct __cacheEntry* e;
+    for (e = c->buckets[h & c->mask]; e != NULL; e = e->next)
+      if (e->hash == h && e->f == f && e->keylen <= sz &&
+          (n == 4 ? e->keylen >= 4 : e->keylen == n) &&
+          memcmp(e->key,blob,e->keylen) == 0)
+        return (e);
+  }
+  return (NULL);
+}
+
+/* Like `__decode`, but answers from the cache `c` where possible; `*insn`
+ * is a persistent copy in any case. The heap is reset on a miss. A decode
+ * cut off by the end of `blob` is not cached, as it might succeed with
+ * more input. */
+__word __decodeCached (struct __cache* c, __obj (*f)(__obj,__obj), __char* blob, __word sz, __obj* insn) {
+  struct __cacheEntry* e = __cacheFindBytes(c,f,blob,sz);
+  if (e != NULL) {
+    __cacheTouch(c,e);
+    *insn = e->value;
+    return (e->length);
+  }
+  c->stats.misses++;
+  __resetHeap();
+  __input.high = blob;
+  __obj i;
+  __word length = __decode(f,blob,sz,&i);
+  if (__inputCut) {
+    c->stats.uncached++;
+    *insn = i;
+    return (length);
+  }
+  __char* high = __input.high > __input.cur ? __input.high : __input.cur;
+  __word keylen = high - blob;
+  if (keylen == 0 || keylen > __CACHE_KEY_MAX) {
+    /* kept as an entry that never matches, so that the copy is
+     * released by the usual eviction */
+    c->stats.uncached++;
+    keylen = 0;
+  }
+  e = __cacheInsert(c,f,__cacheHash(blob,keylen < 4 ? keylen : 4),
+    blob,keylen,i,length);
+  *insn = e->value;
+  return (length);
+}
+
+/* Like `__decodeSuperset`, but decodes through the cache `c`: the suffix
+ * at an offset is only decoded if its bytes were not seen before, which
+ * is common where overlapping decodes meet again. The entries are
+ * persistent copies, valid until they are evicted. */
+__word __decodeSupersetCached (struct __cache* c, __obj (*f)(__obj,__obj), __char* blob, __word sz, __word from, __word to, struct __decoded* out) {
+  __word i;
+  for (i = 0; from + i < to && from + i < sz; i++) {
+    __word at = from + i;
+    out[i].offset = at;
+    out[i].length = __decodeCached(c,f,blob+at,sz-at,&out[i].insn);
+    if (out[i].length == 0)
+      out[i].insn = __UNIT;
+  }
+  return (i);
+}
+
+static void __keyAppend (struct __buffer* b, const void* p, __word n) {
+  memcpy(__reserve(b,n),p,n);
+  b->len += n;
+}
+
+/* Appends a structural encoding of `o` to `b`; objects with the same
+ * encoding are equal. Static closures, labels and blobs are encoded by
+ * their address; returns 0 if `o` contains any other, whose address may
+ * be reused once the heap is reset. */
+static int __objKey (struct __buffer* b, __obj o) {
+  __word i, tag = 0;
+  int ok = 1;
+  if (__IMMEDIATE(o)) {
+    __keyAppend(b,&tag,sizeof(tag));
+    __keyAppend(b,&o,sizeof(o));
+    return (1);
+  }
+  __objref u = __UNWRAP(o);
+  tag = u->object.header.tag + 1;
+  __keyAppend(b,&tag,sizeof(tag));
+  switch (u->object.header.tag) {
+    case __TAGGED:
+      __keyAppend(b,&u->tagged.header,sizeof(__header));
+      return (__objKey(b,u->tagged.payload));
+    case __RECORD:
+      __keyAppend(b,&u->record.header,sizeof(__header));
+      for (i = 0; i < u->record.header.sz && ok; i++) {
+        __keyAppend(b,&u->record.fields[i].header,sizeof(__header));
+        ok = __objKey(b,u->record.fields[i].payload);
+      }
+      return (ok);
+    case __BV:
+      __keyAppend(b,&u->bv.header,sizeof(__header));
+      __keyAppend(b,&u->bv.vec,sizeof(__word));
+      return (1);
+    case __INT:
+      __keyAppend(b,&u->z.value,sizeof(__int));
+      return (1);
+    case __ROPELEAF:
+      __keyAppend(b,&u->ropeleaf.header,sizeof(__header));
+      __keyAppend(b,u->ropeleaf.blob,u->ropeleaf.header.sz);
+      return (1);
+    case __ROPEBRANCH:
+      return (__objKey(b,u->ropebranch.left) &&
+              __objKey(b,u->ropebranch.right));
+    case __NIL:
+      return (1);
+    default:
+      __keyAppend(b,&o,sizeof(o));
+      return (__isStatic(u));
+  }
+}
+
+/* Like `__translate`, but answers from the cache `c` if an equal
+ * instruction was translated before; the result is a persistent copy.
+ * Instructions holding closures, labels or blobs that are not static
+ * are translated but not cached; their translation is in the heap, as
+ * with `__translate`. Unlike `__decodeCached` this does not reset the
+ * heap. */
+__obj __translateCached (struct __cache* c, __obj (*f)(__obj,__obj), __obj insn) {
+  static __thread struct __buffer key;
+  key.len = 0;
+  if (!__objKey(&key,insn)) {
+    c->stats.uncached++;
+    return (__translate(f,insn));
+  }
+  __word h = __cacheHash((__char*)key.data,key.len);
+  struct __cacheEntry* e = __cacheFindKey(c,f,h,(__char*)key.data,key.len);
+  if (e != NULL) {
+    __cacheTouch(c,e);
+    return (e->value);
+  }
+  c->stats.misses++;
+  __obj sem = __translate(f,insn);
+  return (__cacheInsert(c,f,h,(__char*)key.data,key.len,sem,0)->value);
+}
+
+void __getCacheStats (struct __cache* c, struct __cacheStats* stats) {
+  *stats = c->stats;
+}
+
+__obj __printCacheStats (struct __cache* c) {
+  struct __cacheStats s = c->stats;
+  __word n = s.hits + s.misses;
+  printf("cache: %lu, hits: %lu (%lu%%), misses: %lu, evictions: %lu, uncached: %lu, entries: %lu\n",
+    n, s.hits, n == 0 ? 0 : s.hits*100/n, s.misses, s.evictions,
+    s.uncached, s.entries);
+  return (__UNIT);
+}
+
+/* ## Decoder iterators
+ *
+ * The state `init` leaves behind is copied out of the heap once, so every
+ * step can start `next` from it without setting it up again. */
+
+int gdsl_iter_init (gdsl_iter* it, __obj (*init)(__obj,__obj), __obj (*next)(__obj,__obj), __char* blob, __word sz) {
+  memset(it,0,sizeof(*it));
+  it->next = next;
+  it->blob = blob;
+  it->sz = sz;
+  __resetHeap();
+  __LOCAL0(s);
+    __RECORD_BEGIN(s,0);
+    __RECORD_END(s,0);
+  if (init != NULL) {
+    __input.start = __input.cur = __input.high = blob;
+    __input.end = blob;
+    __obj o = __runWithState(init,s);
+    if (___isNil(o))
+      return (-1);
+    s = __RECORD_SELECT(o,___2);
+  }
+  __word n = __persistSize(s);
+  it->mem = malloc(n == 0 ? 1 : n);
+  if (it->mem == NULL)
+    return (-1);
+  __char* mem = it->mem;
+  it->state = __persist(s,&mem);
+  __resetHeap();
+  return (0);
+}
+
+__word gdsl_iter_next (gdsl_iter* it, __word* offset, __obj* insn) {
+  if (it->offset >= it->sz)
+    return (0);
+  __char* start = it->blob + it->offset;
+  __resetHeap();
+  __input.start = __input.cur = __input.high = start;
+  __input.end = it->blob + it->sz;
+  __obj o = __runDecoder(it->next,it->state);
+  __word length;
+  if (___isNil(o) || __input.cur <= start) {
+    *insn = __UNIT;
+    length = 1;
+  } else {
+    *insn = __RECORD_SELECT(o,___1);
+    length = __input.cur - start;
+  }
+  *offset = it->offset;
+  it->offset += length;
+  return (length);
+}
+
+void gdsl_iter_free (gdsl_iter* it) {
+  free(it->mem);
+  it->mem = NULL;
+}
+
+/* Shaped like generated code, as the rest of the translation runs
+ * from its tail call. */
+__obj __cont (__obj __ARG(env), __obj __ARG(f)) {
+  __TAIL_VARS;
+  {
+    __PARAM(env);
+    __PARAM(f);
+    __LOCAL(s,__CLOSURE_REF(env,1));
+    __LOCAL(ff,__CLOSURE_REF(f,0));
+    __JUMP3(__CODE(ff),f,__WRAP(&__haltClosure),s);
+  }
+  __TAIL_EXIT;
+}
+
+static __unwrapped_obj __STATIC_OBJ __contLabel =
+   {.label = {.header.tag = __LABEL, .f = (__obj (*)(void))__cont}};
+
 __obj __translate (__obj (*f)(__obj,__obj), __obj insn) {
+  __ROOT(insn);
   __LOCAL0(s);
     __RECORD_BEGIN(s,0);
     __RECORD_END(s,0);
-  __LOCAL0(k);
-    __LABEL_BEGIN(k);
-    __LABEL_INIT(__cont);
-    __LABEL_END(k);
+  __LOCAL(k, __WRAP(&__contLabel));
   __LOCAL0(envK);
     __CLOSURE_BEGIN(envK,2)
     __CLOSURE_ADD(s);
@@ -459,57 +2062,50 @@ const __char* __tagName (__word i) {
 }
 
 __obj __showbitvec (__obj o) {
-  char fmt[16];
-  snprintf(fmt,16,"0x%zx",o->bv.vec);
-  __LOCAL0(R);
-    __ROPE_BEGIN(R);
-    __ROPE_FROMCSTRING(fmt);
-    __ROPE_END(R);
-  return (R);
+  char fmt[24];
+  snprintf(fmt,24,"0x%zx",__bvVec(o));
+  return (__showString(fmt));
 }
 
 __obj __showint (__obj o) {
   char fmt[64];
-  snprintf(fmt,64,"%ld",o->z.value);
-  __LOCAL0(R);
-    __ROPE_BEGIN(R);
-    __ROPE_FROMCSTRING(fmt);
-    __ROPE_END(R);
-  return (R);
+  snprintf(fmt,64,"%ld",__intValue(o));
+  return (__showString(fmt));
 }
 
 __obj __print (__obj o) {
   switch (__TAG(o)) {
     case __CLOSURE:
-      printf("{tag=__CLOSURE,sz=%zu,env=..}",o->closure.sz);
+      printf("{tag=__CLOSURE,sz=%u,env=..}",__HEADER(o).sz);
       break;
     case __INT:
-      printf("{tag=__INT,value=%ld}", o->z.value);
+      printf("{tag=__INT,value=%ld}", __intValue(o));
       break;
     case __TAGGED: {
-      __word tag = o->tagged.tag;
+      __word tag = __conTag(o);
       if (tag < __NTAGS)
         printf("{tag=%s,",__tagName(tag));
       else
         printf("{tag=<unknown:%lu>,",tag);
       printf("payload=");
-      __print(o->tagged.payload);
+      __print(__conPayload(o));
       printf("}");
       break;
     }
     case __RECORD: {
-      printf("{tag=__RECORD,sz=%lu,", o->record.sz);
+      __word sz = __recordSize(o);
+      printf("{tag=__RECORD,sz=%lu,", sz);
       int i;
-      for (i=0;i<o->record.sz;i++) {
-        __objref tagged = &o->record.fields[i];
-        __word tag = tagged->tagged.tag;
-        __obj payload = tagged->tagged.payload;
+      for (i=0;i<sz;i++) {
+        __field* field = &o->record.fields[i];
+        __word tag = field->header.con;
+        __obj payload = field->payload;
         if (tag < __NFIELDS)
           printf("%s=",__fieldName(tag));
         else
           printf("<unknown:%lu>=",tag);
         __print(payload);
-        if (i < o->record.sz-1)
+        if (i < sz-1)
           printf(",");
       }
       printf("}");
@@ -517,7 +2113,7 @@ __obj __print (__obj o) {
     }
     case __ROPELEAF: {
       char buf[7+1];
-      __word sz = o->ropeleaf.sz;
+      __word sz = __HEADER(o).sz;
       __word len = sz > 7 ? 7 : sz;
       memcpy(buf,o->ropeleaf.blob,len);
       buf[len] = '\0';
@@ -539,11 +2135,17 @@ __obj __print (__obj o) {
       printf("{tag=__BLOB,sz=%lu,blob=%p}",o->blob.sz, o->blob.blob);
       break;
     case __BV:
-      printf("{tag=__BV,sz=%lu,vec=%zx}", o->bv.sz, o->bv.vec);
+      printf("{tag=__BV,sz=%lu,vec=%zx}", __bvSize(o), __bvVec(o));
       break;
     case __NIL:
       printf("{tag=__NIL}");
       break;
+    case __SPAN: {
+      __word len = __spanLength(o);
+      printf("{tag=__SPAN,sz=%lu,blob=%.*s}",len,(int)len,
+        __outputBuffer()->data + __spanOffset(o));
+      break;
+    }
     default:
       printf("{tag=<unknown>,..}");
    }
@@ -563,6 +2165,137 @@ __obj __traceln (__obj (*f)(__obj,__obj), const char* s, __obj o) {
   return (__UNIT);
 }
 
+#ifdef WITHSTATS
+__thread struct __recordStats __recordCounters;
+#endif
+
+void __getRecordStats (struct __recordStats* stats) {
+#ifdef WITHSTATS
+  *stats = __recordCounters;
+#else
+  memset(stats,0,sizeof(*stats));
+#endif
+}
+
+__obj __printRecordStats () {
+  struct __recordStats s;
+  __getRecordStats(&s);
+  __word n = s.hits + s.misses;
+  printf("record-select: %lu, hits: %lu (%lu%%), misses: %lu, probes/miss: %.2f\n",
+    n, s.hits, n == 0 ? 0 : s.hits*100/n, s.misses,
+    s.misses == 0 ? 0.0 : (double)s.probes/s.misses);
+  return (__UNIT);
+}
+
+__thread struct __heapStats __heapCounters;
+
+static const char* const __heapTagNames[__FORWARD] = {
+  "closure","bv","int","tagged","record","nil","blob","ropeleaf",
+  "ropebranch","label","span"
+};
+
+#ifdef WITHSTATS
+/* Books the words allocated since `start` to the decode that just ended;
+ * nothing is booked if the heap was collected in between. */
+static void __countDecode (__word* start) {
+  if (hp > start)
+    return;
+  __word bytes = (start - hp)*sizeof(__word);
+  __word bucket = bytes == 0 ? 0 : 64 - __builtin_clzll(bytes);
+  if (bucket >= __HEAP_BUCKETS)
+    bucket = __HEAP_BUCKETS - 1;
+  __heapCounters.decodes++;
+  __heapCounters.decodeBytes += bytes;
+  if (bytes > __heapCounters.decodeMax)
+    __heapCounters.decodeMax = bytes;
+  __heapCounters.perDecode[bucket]++;
+}
+#endif
+
+void __getHeapStats (struct __heapStats* stats) {
+  *stats = __heapCounters;
+  stats->size = (__heapTop - heap)*sizeof(__word);
+  stats->used = (__heapTop - hp)*sizeof(__word);
+  if (stats->used > stats->highWater)
+    stats->highWater = stats->used;
+}
+
+void __clearHeapStats () {
+  memset(&__heapCounters,0,sizeof(__heapCounters));
+}
+
+__obj __printHeapStats () {
+  struct __heapStats s;
+  __word i;
+  __getHeapStats(&s);
+  printf("heap: %lu bytes, used: %lu, high-water: %lu, resets: %lu\n",
+    s.size, s.used, s.highWater, s.resets);
+  for (i = 0; i < __FORWARD; i++)
+    if (s.objects[i] > 0)
+      printf("  %-10s %12lu objects %14lu bytes\n",
+        __heapTagNames[i], s.objects[i], s.bytes[i]);
+  if (s.decodes == 0)
+    return (__UNIT);
+  printf("decodes: %lu, bytes/decode: %.1f, max: %lu\n",
+    s.decodes, (double)s.decodeBytes/s.decodes, s.decodeMax);
+  for (i = 0; i < __HEAP_BUCKETS; i++)
+    if (s.perDecode[i] > 0)
+      printf("  < %10lu bytes %12lu (%lu%%)\n",
+        i == 0 ? 1 : (__word)1 << i, s.perDecode[i],
+        s.perDecode[i]*100/s.decodes);
+  return (__UNIT);
+}
+
+struct __allocCount __allocCounts[__NALLOCSITES];
+
+#ifdef WITHPROFILE
+__thread __word __allocSite;
+#endif
+
+static int __allocSiteOrder (const void* a, const void* b) {
+  __word x = __allocCounts[*(const __word*)a].bytes;
+  __word y = __allocCounts[*(const __word*)b].bytes;
+  return (x < y ? 1 : x > y ? -1 : 0);
+}
+
+static void __writeAllocProfile (FILE* out) {
+  __word order[__NALLOCSITES];
+  __word i, bytes = 0, objects = 0;
+  for (i = 0; i < __NALLOCSITES; i++) {
+    order[i] = i;
+    bytes += __allocCounts[i].bytes;
+    objects += __allocCounts[i].objects;
+  }
+  qsort(order,__NALLOCSITES,sizeof(__word),__allocSiteOrder);
+  fprintf(out,"allocated: %lu bytes, %lu objects\n",bytes,objects);
+  for (i = 0; i < __NALLOCSITES; i++) {
+    struct __allocCount* c = &__allocCounts[order[i]];
+    if (c->bytes == 0)
+      break;
+    fprintf(out,"%14lu bytes %5.1f%% %12lu objects  %s\n",
+      c->bytes, c->bytes*100.0/bytes, c->objects, __allocSiteNames[order[i]]);
+  }
+}
+
+__obj __printAllocProfile () {
+  __writeAllocProfile(stdout);
+  return (__UNIT);
+}
+
+#ifdef WITHPROFILE
+static void __allocProfileExit () {
+  const char* fn = getenv("GDSL_ALLOC_PROFILE");
+  FILE* out = fn == NULL ? NULL : fopen(fn,"w");
+  __writeAllocProfile(out == NULL ? stderr : out);
+  if (out != NULL)
+    fclose(out);
+}
+
+__attribute__((constructor)) static void __allocProfileInit () {
+  atexit(__allocProfileExit);
+}
+#endif
+
 __obj __isNil (__obj o) {
   switch (__TAG(o)) {
     case __NIL: return (__TRUE);
@@ -578,11 +2311,10 @@ int ___isNil (__obj o) {
 }
 
 __obj __printState () {
-  ptrdiff_t d = &heap[__RT_HEAP_SIZE] - hp;
-  int n = d / sizeof(__unwrapped_obj);
-  int used = n*100/__RT_HEAP_SIZE;
-  printf("heap: %p, hp: %p, size: %u, used: %d (%d%%), obj-size: %zu\n",
-    &heap[0], hp, __RT_HEAP_SIZE, n, used, sizeof(__unwrapped_obj));
+  struct __heapStats s;
+  __getHeapStats(&s);
+  printf("heap: %p, hp: %p, size: %lu bytes, used: %lu (%lu%%), high-water: %lu\n",
+    heap, hp, s.size, s.used, s.size == 0 ? 0 : s.used*100/s.size, s.highWater);
   return (__UNIT);
 }
 
@@ -10,12 +10,57 @@
 #include <stddef.h>
 #include <string.h>
 
-#define __RT_HEAP_SIZE (4*1024*1024)
+@options@
+
+/* Default size of the heap in words. The heap is mapped lazily on the
+ * first allocation; its size can be chosen at runtime either by calling
+ * `__initHeap()` or by setting `GDSL_HEAP_SIZE` (bytes, with an optional
+ * `k`, `m` or `g` suffix) in the environment. */
+#ifndef __RT_HEAP_SIZE
+#define __RT_HEAP_SIZE (12*1024*1024)
+#endif
+
+/* Words kept free for the allocations between two `__CHECK_HEAP`s if the
+ * runtime is compiled with the garbage collector (`-DWITHGC`). */
+#ifndef __GC_RESERVE
+#define __GC_RESERVE (192*1024)
+#endif
 
-#define __CHECK_HEAP(n) /* TODO: check for heap-overflow */
-#define __ALLOC1() --hp /* TODO: check for heap-overflow */
-#define __ALLOC0() hp /* TODO: check for heap-overfl(4*1024) */
-#define __ALLOCN(n) hp-=n /* TODO: check for heap-overflow */
+/* The heap is a sequence of words that grows downwards from `__heapTop`
+ * to `heap`; every object takes as many words as its kind needs (see
+ * `__WORDS`). Running below `heap` is caught by the checks below; the
+ * guard page mapped underneath `heap` catches everything else. With
+ * `WITHGC` the checks are the points where the heap is collected, so they
+ * keep a reserve. */
+#ifdef WITHGC
+#define __CHECK_HEAP(n)\
+  {if (hp - heap < (ptrdiff_t)(n) + __GC_RESERVE) __heapOverflow(n,0);}
+#else
+#define __CHECK_HEAP(n)\
+  {if (hp - heap < (ptrdiff_t)(n)) __heapOverflow(n,0);}
+#endif
+#define __WORDS(kind) (sizeof(struct __unwrapped_##kind)/sizeof(__word))
+#define __BYTE_WORDS(n) (((n) + sizeof(__word) - 1)/sizeof(__word))
+/* `__ALLOC` counts the object under its tag (see `__HEAP_STAT`),
+ * `__ALLOCFOR` counts words owned by an object with the given tag. */
+#define __ALLOC(kind)\
+  (__HEAP_STAT(__TAGOF_##kind,__WORDS(kind),1), __ALLOCN(__WORDS(kind)))
+#define __ALLOCFOR(tag, n)\
+  (__HEAP_STAT(tag,n,0), __ALLOCN(n))
+#define __ALLOC0() ((void*)hp)
+#define __ALLOCN(n)\
+  (hp - heap >= (ptrdiff_t)(n) ?\
+    (__objref)(hp -= (n)) : __heapOverflow(n,n))
+
+#define __TAGOF_closure __CLOSURE
+#define __TAGOF_bv __BV
+#define __TAGOF_int __INT
+#define __TAGOF_tagged __TAGGED
+#define __TAGOF_record __RECORD
+#define __TAGOF_blob __BLOB
+#define __TAGOF_ropeleaf __ROPELEAF
+#define __TAGOF_ropebranch __ROPEBRANCH
+#define __TAGOF_label __LABEL
 
 #define __INVOKE1(o, closure)\
   ((__obj(*)(__obj))((o)->label.f))(closure)
@@ -40,26 +85,92 @@
 
 #define __FCALL(f,...) f(__VA_ARGS__)
 
+/* The generated code leaves a function with `__JUMP1` to `__JUMP7`, on
+ * the code of a label (`__CODE`) or a function. With `WITHGC` or
+ * `WITHPROFILE` the locals of a function (see `__ROOT`, `__ALLOC_SITE`)
+ * live in a block of their own, which has to be left before the call:
+ * the callee and its arguments are kept in `__TAIL_VARS` and called by
+ * `__TAIL_EXIT` after the block, so that the call remains a jump. */
+#define __CODE(o) ((o)->label.f)
+
+#if defined(WITHGC) || defined(WITHPROFILE)
+#define __TAIL_VARS\
+  __obj (*__tf)(void);\
+  __obj __t0, __t1, __t2, __t3, __t4, __t5, __t6
+#define __TAIL_EXIT\
+  __tail1: __attribute__((unused));\
+  return (((__obj(*)(__obj))__tf)(__t0));\
+  __tail2: __attribute__((unused));\
+  return (((__obj(*)(__obj,__obj))__tf)(__t0,__t1));\
+  __tail3: __attribute__((unused));\
+  return (((__obj(*)(__obj,__obj,__obj))__tf)(__t0,__t1,__t2));\
+  __tail4: __attribute__((unused));\
+  return (((__obj(*)(__obj,__obj,__obj,__obj))__tf)(__t0,__t1,__t2,__t3));\
+  __tail5: __attribute__((unused));\
+  return (((__obj(*)(__obj,__obj,__obj,__obj,__obj))__tf)\
+    (__t0,__t1,__t2,__t3,__t4));\
+  __tail6: __attribute__((unused));\
+  return (((__obj(*)(__obj,__obj,__obj,__obj,__obj,__obj))__tf)\
+    (__t0,__t1,__t2,__t3,__t4,__t5));\
+  __tail7: __attribute__((unused));\
+  return (((__obj(*)(__obj,__obj,__obj,__obj,__obj,__obj,__obj))__tf)\
+    (__t0,__t1,__t2,__t3,__t4,__t5,__t6))
+#define __JUMP1(f, a)\
+  {__tf = (__obj(*)(void))(f); __t0 = a; goto __tail1;}
+#define __JUMP2(f, a, b)\
+  {__tf = (__obj(*)(void))(f); __t0 = a; __t1 = b; goto __tail2;}
+#define __JUMP3(f, a, b, c)\
+  {__tf = (__obj(*)(void))(f); __t0 = a; __t1 = b; __t2 = c; goto __tail3;}
+#define __JUMP4(f, a, b, c, d)\
+  {__tf = (__obj(*)(void))(f); __t0 = a; __t1 = b; __t2 = c; __t3 = d;\
+   goto __tail4;}
+#define __JUMP5(f, a, b, c, d, e)\
+  {__tf = (__obj(*)(void))(f); __t0 = a; __t1 = b; __t2 = c; __t3 = d;\
+   __t4 = e; goto __tail5;}
+#define __JUMP6(f, a, b, c, d, e, g)\
+  {__tf = (__obj(*)(void))(f); __t0 = a; __t1 = b; __t2 = c; __t3 = d;\
+   __t4 = e; __t5 = g; goto __tail6;}
+#define __JUMP7(f, a, b, c, d, e, g, h)\
+  {__tf = (__obj(*)(void))(f); __t0 = a; __t1 = b; __t2 = c; __t3 = d;\
+   __t4 = e; __t5 = g; __t6 = h; goto __tail7;}
+#else
+#define __TAIL_VARS
+#define __TAIL_EXIT
+#define __JUMP1(f, a)\
+  return (((__obj(*)(__obj))(f))(a))
+#define __JUMP2(f, a, b)\
+  return (((__obj(*)(__obj,__obj))(f))(a,b))
+#define __JUMP3(f, a, b, c)\
+  return (((__obj(*)(__obj,__obj,__obj))(f))(a,b,c))
+#define __JUMP4(f, a, b, c, d)\
+  return (((__obj(*)(__obj,__obj,__obj,__obj))(f))(a,b,c,d))
+#define __JUMP5(f, a, b, c, d, e)\
+  return (((__obj(*)(__obj,__obj,__obj,__obj,__obj))(f))(a,b,c,d,e))
+#define __JUMP6(f, a, b, c, d, e, g)\
+  return (((__obj(*)(__obj,__obj,__obj,__obj,__obj,__obj))(f))\
+    (a,b,c,d,e,g))
+#define __JUMP7(f, a, b, c, d, e, g, h)\
+  return (((__obj(*)(__obj,__obj,__obj,__obj,__obj,__obj,__obj))(f))\
+    (a,b,c,d,e,g,h))
+#endif
+
 /** ## Integers */
 
-#define __INT_BEGIN(Cname)\
-  __CHECK_HEAP(1)
+#define __INT_BEGIN(Cname)
 
 #define __INT_INIT(val)\
-  {__objref o = __ALLOC1();\
-   o->z.header.tag = __INT;\
-   o->z.value = val
-   
+  {__int __z = val
+
 #define __INT_END(Cname)\
-   Cname = __WRAP(o);}
+   Cname = __mkInt(__z);}
 
 /** ## Labels */
 
 #define __LABEL_BEGIN(Cname)\
-  __CHECK_HEAP(1)
+  __CHECK_HEAP(__WORDS(label))
 
 #define __LABEL_INIT(val)\
-  {__objref o = __ALLOC1();\
+  {__objref o = __ALLOC(label);\
    o->label.header.tag = __LABEL;\
    o->label.f = (__obj (*)(void)) val
    
@@ -68,78 +179,90 @@
 
 /** ## Closures */
 
+/* The environment is a word per captured value. The code generator adds
+ * the values in reverse order. */
 #define __CLOSURE_BEGIN(Cname, n)\
-   __CHECK_HEAP(n+1)
+   {__obj* __env = (__obj*)__ALLOCFOR(__CLOSURE,n);\
+    __word __envSz = n;
 
 #define __CLOSURE_ADD(value)\
-   {__objref o = __ALLOC1();\
-    *o = *(__UNWRAP(value));}
+    __env[--__envSz] = value
 
 #define __CLOSURE_END(Cname, n)\
-   {__objref o = __ALLOC1();\
+   {__objref o = __ALLOC(closure);\
     o->closure.header.tag = __CLOSURE;\
-    o->closure.sz = n;\
-    o->closure.env = o+1;\
-    Cname = __WRAP(o);}
+    o->closure.header.sz = n;\
+    o->closure.env = __env;\
+    Cname = __WRAP(o);}}
 
-#define __CLOSURE_REF(Cname, n) (__WRAP(&(Cname->closure.env[n])))
+#define __CLOSURE_REF(Cname, n) (Cname->closure.env[n])
 
 /** ## Records */
 
 /* PERF: A more efficient data-structure for records is needed.
  * maybe versioned arrays or some kind of list/stack with the
- * most recently added fields on-top. */
+ * most recently added fields on-top.
+ *
+ * A field is the selector and the value, like a tagged object; the
+ * fields of a record follow the record. */
 #define __RECORD_BEGIN(Cname, n)\
-  __CHECK_HEAP(n+1)
+  __CHECK_HEAP(__WORDS(record)+(n)*__WORDS(tagged))
 
 #define __RECORD_ADD(field, value)\
-  {__objref o = __ALLOC1();\
-   o->tagged.header.tag = __TAGGED;\
-   o->tagged.tag = field;\
-   o->tagged.payload = value;}
+  {__field* f = (__field*)__ALLOCFOR(__RECORD,__WORDS(tagged));\
+   f->header.tag = __TAGGED;\
+   f->header.con = field;\
+   f->payload = value;}
 
 #define __RECORD_END(Cname, n)\
-  {__objref o = __ALLOC1();\
+  {__objref o = __ALLOC(record);\
    o->record.header.tag = __RECORD;\
-   o->record.sz = n;\
-   o->record.fields = o+1;\
+   o->record.header.sz = n;\
+   o->record.fields = __FIELDS(o);\
    Cname = __WRAP(o);}
 
+#define __FIELDS(o) ((__field*)((__word*)(o) + __WORDS(record)))
+
 #define __RECORD_BEGIN_UPDATE(Cdst, Csrc)\
-  {__recordCloneFields((struct __record*)Csrc);\
-   __word n = Csrc->record.sz
+  {__recordCloneFields(Csrc);\
+   __word n = __recordSize(Csrc)
 
 #define __RECORD_UPDATE(tag, value)\
    n += __recordUpdate(__ALLOC0(),n,tag,value)
 
 #define __RECORD_END_UPDATE(Cdst)\
-  {__objref o = __ALLOC1();\
+  {__objref o = __ALLOC(record);\
    o->record.header.tag = __RECORD;\
-   o->record.sz = n;\
-   o->record.fields = o+1;\
+   o->record.header.sz = n;\
+   o->record.fields = __FIELDS(o);\
    Cdst = __WRAP(o);}}
 
 #define __RECORD_SELECT(Cname, field)\
-  __recordLookup(((struct __record*)Cname), field)->tagged.payload
+  __recordLookup(Cname, field)->payload
+
+/* Used by the generated code: every select site owns a slot in
+ * `__icache` remembering where it found its field the last time. */
+#define __RECORD_SELECT_CACHED(Cname, field, site)\
+  __recordLookupCached(Cname, field, &__icache[site])->payload
 
 /** ## Ropes/Strings */
 
-#define __ROPE_BEGIN(Cname) /* TODO: CHECK HEAP */
+#define __ROPE_BEGIN(Cname)
 
 #define __ROPE_CONCAT(a,b)\
-  {__objref o = __ALLOC1();\
+  {__objref o = __ALLOC(ropebranch);\
    o->ropebranch.header.tag = __ROPEBRANCH;\
    o->ropebranch.left = a;\
    o->ropebranch.right = b;
 
+/* Copies `s`; string literals of the specification are emitted as static
+ * leaves pointing into the data segment instead. */
 #define __ROPE_FROMCSTRING(s)\
-  {__objref o = __ALLOC1();\
+  {__objref o = __ALLOC(ropeleaf);\
    __int len = strlen(s);\
-   __int n = len/sizeof(__unwrapped_obj);\
-   n = ((len % sizeof(__unwrapped_obj)) == 0) ? n : n + 1;\
    o->ropeleaf.header.tag = __ROPELEAF;\
-   o->ropeleaf.sz = len;\
-   __objref p = __ALLOCN(n);\
+   o->ropeleaf.header.sz = len;\
+   __objref p = __ALLOCFOR(__ROPELEAF,__BYTE_WORDS(len));\
    memcpy(p,s,len);\
    o->ropeleaf.blob = (__char*)p;
 
@@ -148,42 +271,32 @@
 
 /** ## Bitvectors */
 
-#define __BV_BEGIN(Cname, n)\
-  __CHECK_HEAP(1)
+#define __BV_BEGIN(Cname, n)
 
 #define __BV_INIT(value)\
-  {__objref o = __ALLOC1();\
-   o->bv.header.tag = __BV;\
-   o->bv.vec = value;\
+  {__word __vec = value;
 
 #define __BV_END(Cname, n)\
-   o->bv.sz = n;\
-   Cname = __WRAP(o);}
+   Cname = __mkBV(__vec,n);}
 
 /** ## Tagged values (datatypes) */
 
-#define __TAGGED_BEGIN(Cname)\
-  __CHECK_HEAP(1)
+#define __TAGGED_BEGIN(Cname)
 
 #define __TAGGED_INIT(con, value)\
-  {__objref o = __ALLOC1();\
-   o->tagged.header.tag = __TAGGED;\
-   o->tagged.tag = con;\
-   o->tagged.payload = value;
+  {__word __con = con;\
+   __obj __payload = value;
 
 #define __TAGGED_END(Cname)\
-   Cname = __WRAP(o);}
-
-#define __TAGGED_BEGIN(Cname)\
-  __CHECK_HEAP(1)
+   Cname = __mkTagged(__con,__payload);}
 
 /** ## Blobs */
 
 #define __BLOB_BEGIN(Cname)\
-  __CHECK_HEAP(1)
+  __CHECK_HEAP(__WORDS(blob))
 
 #define __BLOB_INIT(buf, size)\
-  {__objref o = __ALLOC1();\
+  {__objref o = __ALLOC(blob);\
    o->blob.header.tag = __BLOB;\
    o->blob.blob = buf;\
    o->blob.sz = size;
@@ -191,10 +304,25 @@
 #define __BLOB_END(Cname)\
    Cname = __WRAP(o);}
 
+/* With `WITHGC` every local and parameter of the generated code (see
+ * `__ROOT`) is a root of the collector while it is in scope. A generated
+ * function takes its parameters as `__ARG`s and copies them into rooted
+ * locals with `__PARAM`, so that their addresses do not escape the block
+ * that is left before the tail call (see `__JUMP2`). */
+#ifdef WITHGC
+#define __LOCAL0(Cname) __obj Cname = __UNIT; __ROOT(Cname)
+#define __LOCAL(Cname, body) __obj Cname = body; __ROOT(Cname)
+#define __ROOT(x)\
+  __obj* __root_##x __attribute__((cleanup(__gcPop),unused)) = __gcPush(&x)
+#else
 #define __LOCAL0(Cname) __obj Cname
 #define __LOCAL(Cname, body) __obj Cname = body
+#define __ROOT(x)
+#endif
+#define __ARG(x) __arg_##x
+#define __PARAM(x) __LOCAL(x, __ARG(x))
 
-typedef union __header __header;
+typedef struct __header __header;
 typedef union __unwrapped_obj __unwrapped_obj;
 typedef union __wrapped_obj __wrapped_obj;
 typedef __unwrapped_obj* __objref;
@@ -213,36 +341,41 @@ enum __tag {
   __BLOB,
   __ROPELEAF,
   __ROPEBRANCH,
-  __LABEL
+  __LABEL,
+  __SPAN,
+  __FORWARD
 };
 
-union __header {
-  enum __tag tag;
-  __obj ignored;
+/* One word: the tag and the size of the object (fields of a record,
+ * slots of a closure, bits of a bitvector, bytes of a rope leaf) or the
+ * constructor of a tagged object (the selector of a record field). */
+struct __header {
+  uint32_t tag;
+  union {
+    uint32_t sz;
+    uint32_t con;
+  };
 } __attribute__((aligned(8)));
 
+/* Objects on the heap only take the words of their own member. */
 union __unwrapped_obj {
   struct __unwrapped_immediate {
     __header header;
   } object;
   struct __unwrapped_tagged {
     __header header;
-    __word tag;
     __obj payload;
   } tagged;
   struct __unwrapped_closure {
     __header header;
-    __word sz;
-    __objref env;
+    __obj* env;
   } closure;
   struct __unwrapped_record {
     __header header;
-    __word sz;
-    __objref fields;
+    struct __unwrapped_tagged* fields;
   } record;
   struct __unwrapped_bv {
     __header header;
-    __word sz;
     __word vec;
   } bv;
   struct __unwrapped_label {
@@ -257,7 +390,6 @@ union __unwrapped_obj {
   struct __unwrapped_ropeleaf {
     __header header;
     __char* blob;
-    __word sz;
   } ropeleaf;
   struct __unwrapped_ropebranch {
     __header header;
@@ -268,23 +400,28 @@ union __unwrapped_obj {
     __header header;
     __int value;
   } z;
+  /* left behind by the collector in place of a copied object */
+  struct __unwrapped_forward {
+    __header header;
+    __obj to;
+  } forward;
 } __attribute__((aligned(8)));
 
+/* A record field: a tagged object with the field's selector. */
+typedef struct __unwrapped_tagged __field;
+
+/* The view after the header; the header of `o` is at `__HEADER(o)`. */
 union __wrapped_obj {
   struct __tagged {
-    __word tag;
     __obj payload;
   } tagged;
   struct __closure {
-    __word sz;
-    __objref env;
+    __obj* env;
   } closure;
   struct __record {
-    __word sz;
-    __objref fields;
+    __field* fields;
   } record;
   struct __bv {
-    __word sz;
     __word vec;
   } bv;
   struct __label {
@@ -296,7 +433,6 @@ union __wrapped_obj {
   } blob;
   struct __ropeleaf {
     __char* blob;
-    __word sz;
   } ropeleaf;
   struct __ropebranch {
     __obj left;
@@ -309,7 +445,46 @@ union __wrapped_obj {
 
 #define __WRAP(x) ((__obj)(((__header*)x)+1))
 #define __UNWRAP(x) ((__objref)(((__header*)x)-1))
-#define __TAG(x) ((__UNWRAP((__obj)x))->object.header.tag)
+#define __HEADER(x) (((__header*)x)[-1])
+#define __TAG(x) (__tagOf((__obj)x))
+
+/* ## Immediate objects
+ *
+ * Heap objects are 8-byte aligned, so the low bits of an `__obj` are free
+ * to mark values that are stored in the reference itself:
+ *
+ *   ......1  bitvector, size in bits 1-6, vector in bits 7-63
+ *   .....10  integer, value in bits 3-63
+ *   ....100  constructor without payload, tag in bits 3-63
+ *   ....110  string span of the output buffer, offset in bits 3-34 and
+ *            length in bits 35-63 (only with `DIRECTSTRINGS`)
+ *   ....000  pointer to a heap (or static) object
+ *
+ * Bitvectors of up to `__IMM_BV_BITS` bits and integers that fit into 61
+ * bits are always immediate, so equal values have equal references. Use
+ * the accessors below instead of dereferencing such objects. */
+
+#define __IMMEDIATE(x) (((uintptr_t)(x)) & 7)
+#define __IMM_BV_BITS 56
+#define __IMM_INT_MIN (-((__int)1 << 60))
+#define __IMM_INT_MAX (((__int)1 << 60) - 1)
+#define __IMM_BV(vec, sz)\
+  ((__obj)((((__word)(vec)) << 7) | (((__word)(sz)) << 1) | 1))
+#define __IMM_INT(z) ((__obj)((((__word)(z)) << 3) | 2))
+#define __IMM_CON(con) ((__obj)((((__word)(con)) << 3) | 4))
+#define __IMM_SPAN(off, len)\
+  ((__obj)((((__word)(len)) << 35) | (((__word)(off)) << 3) | 6))
+
+static inline enum __tag __tagOf (__obj o) {
+  if (((uintptr_t)o) & 1)
+    return (__BV);
+  switch (__IMMEDIATE(o)) {
+    case 2: return (__INT);
+    case 4: return (__TAGGED);
+    case 6: return (__SPAN);
+    default: return (__UNWRAP(o)->object.header.tag);
+  }
+}
 
 #ifndef RELAXEDFATAL
 #define __FATAL(type) __fatal("%s:%d:%s",__FILE__,__LINE__,#type)
@@ -320,11 +495,251 @@ union __wrapped_obj {
 #endif
 
 void __fatal(char*,...) __attribute__((noreturn));
-__unwrapped_obj heap[__RT_HEAP_SIZE] __attribute__((aligned(8)));
-__objref hp;
-__obj __UNIT;
-__obj __TRUE;
-__obj __FALSE;
+extern __thread __word* heap;
+extern __thread __word* hp;
+extern __thread __word* __heapTop;
+extern struct __unwrapped_immediate __unwrapped_UNIT;
+
+/* Static objects (the constants of the code generator and those of the
+ * runtime) go to a section of their own, so that they can be told apart
+ * from objects in the heap or elsewhere in memory. They are not declared
+ * `const`: most of them hold pointers and are writable when relocated
+ * (`-fPIC`, `-fPIE`), and all objects of a section must agree on that. */
+#define __STATIC_OBJ __attribute__((section("gdsl_static")))
+
+/* Constant expressions, so that they can be used to initialize the
+ * static objects emitted by the code generator. */
+#define __UNIT __WRAP(&__unwrapped_UNIT)
+
+#define __TRUE __IMM_BV(1,1)
+#define __FALSE __IMM_BV(0,1)
+
+/* ## Heap management */
+
+#define __HEAP_HUGEPAGES 1
+
+void __initHeap(__word,int);
+void __freeHeap();
+__objref __heapOverflow(__word,__word);
+
+/* ## Garbage collection
+ *
+ * Compiled in with `-DWITHGC`. If a `__CHECK_HEAP` finds less than
+ * `__GC_RESERVE` words free, the objects reachable from the roots are
+ * copied into a second heap of the same size, which then becomes the
+ * heap (Cheney's algorithm); `__resetHeap` keeps what survived. The roots
+ * are the locals and parameters of the generated code that are in scope
+ * on the calling thread, kept on a shadow stack, and the locations a C
+ * caller registered with `__gcRoot` until it calls `__gcUnroot`; other
+ * references into the heap are stale after a collection. `__gcCollect`
+ * collects right away. Sweeps that hand out several instructions at a
+ * time (`__decodeMany`, `__decodeSuperset`, pipeline stages) do not
+ * collect. The roots of a generated function are popped before its tail
+ * call, so the shadow stack and the C stack stay as deep as the calls
+ * that do return. Without `WITHGC` these functions do nothing. */
+
+struct __gcStats {
+  __word collections;
+  /* words that survived the last collection */
+  __word live;
+  __word maxLive;
+  /* nanoseconds */
+  __word pause;
+  __word maxPause;
+  __word totalPause;
+};
+
+void __gcRoot(__obj*);
+void __gcUnroot(__obj*);
+void __gcCollect();
+void __getGCStats(struct __gcStats*);
+__obj __printGCStats();
+
+#ifdef WITHGC
+extern __thread __obj** __gcStack;
+extern __thread __word __gcDepth;
+extern __thread __word __gcCapacity;
+void __gcGrow();
+
+static inline __obj* __gcPush (__obj* x) {
+  if (__gcDepth == __gcCapacity)
+    __gcGrow();
+  __gcStack[__gcDepth++] = x;
+  return (x);
+}
+
+static inline void __gcPop (__obj** x) {
+  __gcDepth--;
+}
+#endif
+
+/* ## Heap statistics
+ *
+ * In bytes: `size` of the heap, `used` since the last `__resetHeap` and
+ * the `highWater` mark of the use at any reset; `resets` counts these.
+ * With `-DWITHSTATS` the runtime also counts the objects of every tag and
+ * the bytes they take (a record owns its fields, a closure its
+ * environment and a rope leaf its bytes), and the bytes each decode
+ * allocates: `perDecode[0]` counts decodes that allocated nothing,
+ * `perDecode[i]` those that took less than 2^i bytes but at least
+ * 2^(i-1). The counters are those of the calling thread. */
+
+#define __HEAP_BUCKETS 32
+
+struct __heapStats {
+  __word size;
+  __word used;
+  __word highWater;
+  __word resets;
+  __word objects[__FORWARD];
+  __word bytes[__FORWARD];
+  __word decodes;
+  __word decodeBytes;
+  __word decodeMax;
+  __word perDecode[__HEAP_BUCKETS];
+};
+
+void __getHeapStats(struct __heapStats*);
+void __clearHeapStats();
+__obj __printHeapStats();
+
+extern __thread struct __heapStats __heapCounters;
+
+/* ## Allocation profile
+ *
+ * Compiled in with `-DWITHPROFILE`. The code generator marks every
+ * function with `__ALLOC_SITE`; the runtime counts the objects and bytes
+ * allocated while a function is the innermost one running, summed over
+ * all threads. What the runtime allocates outside of generated code goes
+ * to `<runtime>`. At exit the sites are reported by bytes to stderr, or
+ * to the file named by `GDSL_ALLOC_PROFILE`; `__printAllocProfile` prints
+ * the same report to stdout. The previous site is restored before a tail
+ * call, so the site of the callee is the innermost one. */
+
+struct __allocCount {
+  __word objects;
+  __word bytes;
+};
+
+__obj __printAllocProfile();
+
+#ifdef WITHPROFILE
+extern struct __allocCount __allocCounts[];
+extern __thread __word __allocSite;
+
+static inline __word __allocEnter (__word site) {
+  __word prev = __allocSite;
+  __allocSite = site;
+  return (prev);
+}
+
+static inline void __allocLeave (__word* prev) {
+  __allocSite = *prev;
+}
+
+#define __ALLOC_SITE(site)\
+  __word __allocPrev __attribute__((cleanup(__allocLeave),unused)) =\
+    __allocEnter(site)
+#define __PROFILE_STAT(words, n)\
+  (__atomic_fetch_add(&__allocCounts[__allocSite].bytes,\
+     (words)*sizeof(__word),__ATOMIC_RELAXED),\
+   __atomic_fetch_add(&__allocCounts[__allocSite].objects,\
+     (n),__ATOMIC_RELAXED))
+#else
+#define __ALLOC_SITE(site)
+#define __PROFILE_STAT(words, n) ((void)0)
+#endif
+
+#ifdef WITHSTATS
+#define __HEAP_STAT(tag, words, n)\
+  (__heapCounters.bytes[tag] += (words)*sizeof(__word),\
+   __heapCounters.objects[tag] += (n),\
+   __PROFILE_STAT(words,n))
+#else
+#define __HEAP_STAT(tag, words, n) __PROFILE_STAT(words,n)
+#endif
+
+/* ## Accessors and constructors for possibly immediate objects */
+
+static inline __word __bvMask (__word sz) {
+  return (sz >= 64 ? ~((__word)0) : (((__word)1) << sz) - 1);
+}
+
+static inline __word __bvVec (__obj o) {
+  return (__IMMEDIATE(o) ? ((__word)o) >> 7 : o->bv.vec);
+}
+
+static inline __word __bvSize (__obj o) {
+  return (__IMMEDIATE(o) ? (((__word)o) >> 1) & 63 : __HEADER(o).sz);
+}
+
+static inline __int __intValue (__obj o) {
+  return (__IMMEDIATE(o) ? ((__int)o) >> 3 : o->z.value);
+}
+
+static inline __word __conTag (__obj o) {
+  return (__IMMEDIATE(o) ? ((__word)o) >> 3 : __HEADER(o).con);
+}
+
+static inline __obj __conPayload (__obj o) {
+  return (__IMMEDIATE(o) ? __UNIT : o->tagged.payload);
+}
+
+static inline __word __spanOffset (__obj o) {
+  return ((((__word)o) >> 3) & 0xffffffff);
+}
+
+static inline __word __spanLength (__obj o) {
+  return (((__word)o) >> 35);
+}
+
+static inline __word __recordSize (__obj o) {
+  return (__HEADER(o).sz);
+}
+
+static inline __obj __mkBV (__word vec, __word sz) {
+  vec &= __bvMask(sz);
+  if (sz <= __IMM_BV_BITS)
+    return (__IMM_BV(vec,sz));
+  __objref o = __ALLOC(bv);
+  o->bv.header.tag = __BV;
+  o->bv.header.sz = sz;
+  o->bv.vec = vec;
+  return (__WRAP(o));
+}
+
+static inline __obj __mkInt (__int z) {
+  if (z >= __IMM_INT_MIN && z <= __IMM_INT_MAX)
+    return (__IMM_INT(z));
+  __objref o = __ALLOC(int);
+  o->z.header.tag = __INT;
+  o->z.value = z;
+  return (__WRAP(o));
+}
+
+static inline __obj __mkTagged (__word con, __obj payload) {
+  if (payload == __UNIT)
+    return (__IMM_CON(con));
+  __objref o = __ALLOC(tagged);
+  o->tagged.header.tag = __TAGGED;
+  o->tagged.header.con = con;
+  o->tagged.payload = payload;
+  return (__WRAP(o));
+}
+
+/* ## Decoder contexts
+ *
+ * A context owns a heap and its allocation pointer. Every thread starts
+ * out with an implicit context of its own, so threads can decode in
+ * parallel without further setup; explicit contexts allow handing heaps
+ * between threads or keeping several of them per thread. `__initHeap`,
+ * `__freeHeap` and `__resetHeap` act on the active context. */
+
+typedef struct gdsl_ctx gdsl_ctx;
+
+gdsl_ctx* gdsl_ctx_new(__word,int);
+void gdsl_ctx_free(gdsl_ctx*);
+gdsl_ctx* gdsl_ctx_enter(gdsl_ctx*);
 
 /* ## Constructor tags */
 
@@ -340,6 +755,20 @@ __obj __FALSE;
 
 @exports@
 
+/* ## Record lookup statistics
+ *
+ * Only collected if the runtime is compiled with `-DWITHSTATS`; `probes`
+ * counts the fields scanned after a miss. */
+
+struct __recordStats {
+  __word hits;
+  __word misses;
+  __word probes;
+};
+
+void __getRecordStats(struct __recordStats*);
+__obj __printRecordStats();
+
 /* ## Primitive runtime functions */
 
 const __char* __tagName(__word);
@@ -350,12 +779,12 @@ __obj __print(__obj);
 __obj __println(__obj);
 __obj __traceln(__obj(*)(__obj,__obj),const char*,__obj);
 
-static inline __objref __recordLookup (struct __record* record, __word field) {
-  __word i, sz = record->sz;
-  __objref fields = record->fields;
+static inline __field* __recordLookup (__obj record, __word field) {
+  __word i, sz = __recordSize(record);
+  __field* fields = record->record.fields;
   for (i = 0; i < sz; i++) {
-    __objref o = &fields[i];
-    if (o->tagged.tag == field)
+    __field* o = &fields[i];
+    if (o->header.con == field)
        return (o);
   }
   if (field < __NFIELDS)
@@ -364,35 +793,64 @@ static inline __objref __recordLookup (struct __record* record, __word field) {
     __fatal("record-field '%zu' not found",field);
 }
 
-static inline __word __recordUpdate (__objref fields, __word n, __word field, __obj value) {
+#ifdef WITHSTATS
+extern __thread struct __recordStats __recordCounters;
+#define __RECORD_STAT(stat) __recordCounters.stat++
+#else
+#define __RECORD_STAT(stat)
+#endif
+
+static inline __field* __recordLookupCached (__obj record, __word field, __word* slot) {
+  __word i = *slot, sz = __recordSize(record);
+  __field* fields = record->record.fields;
+  if (i < sz && fields[i].header.con == field) {
+    __RECORD_STAT(hits);
+    return (&fields[i]);
+  }
+  __RECORD_STAT(misses);
+  for (i = 0; i < sz; i++) {
+    __RECORD_STAT(probes);
+    __field* o = &fields[i];
+    if (o->header.con == field) {
+      *slot = i;
+      return (o);
+    }
+  }
+  if (field < __NFIELDS)
+    __fatal("record-field '%s' not found",__fieldName(field));
+  else
+    __fatal("record-field '%zu' not found",field);
+}
+
+static inline __word __recordUpdate (__field* fields, __word n, __word field, __obj value) {
   __word i;
   for (i = 0; i < n; i++) {
-    __objref o = &fields[i];
-    if (o->tagged.tag == field) {
+    __field* o = &fields[i];
+    if (o->header.con == field) {
        /* Overwriting already exisiting field */
-       o->tagged.payload = value;
+       o->payload = value;
        return (0);
     }
   }
   /* Allocating new record field */
-  __objref o = __ALLOC1();
-  o->tagged.header.tag = __TAGGED;
-  o->tagged.tag = field;
-  o->tagged.payload = value;
+  __field* o = (__field*)__ALLOCFOR(__RECORD,__WORDS(tagged));
+  o->header.tag = __TAGGED;
+  o->header.con = field;
+  o->payload = value;
   return (1);
 }
 
-static inline void __recordCloneFields (struct __record* record) {
-  __word sz = record->sz;
-  __objref fields = __ALLOCN(sz);
-  memcpy(fields, record->fields, sz*sizeof(__unwrapped_obj));
+static inline void __recordCloneFields (__obj record) {
+  __word sz = __recordSize(record);
+  __objref fields = __ALLOCFOR(__RECORD,sz*__WORDS(tagged));
+  memcpy(fields, record->record.fields, sz*sizeof(__field));
 }
 
 /* #define __DECON(o) (o)->tagged.payload */
 /* PERF */
 static inline __obj __DECON (__obj o) {
   switch (__TAG(o)) {
-    case __TAGGED: return (o->tagged.payload);
+    case __TAGGED: return (__conPayload(o));
     default: return o;
   }
 }
@@ -400,33 +858,45 @@ static inline __obj __DECON (__obj o) {
 static inline __word __CASETAG (__obj o) {
   switch (__TAG(o)) {
     case __INT:
-      return ((__word)o->z.value);
+      return ((__word)__intValue(o));
     case __TAGGED:
-      return (o->tagged.tag);
+      return (__conTag(o));
     case __BV:
-      return (o->bv.vec);
+      return (__bvVec(o));
     default:
       __fatal("__CASETAG() applied to non-tagged object");
   }
 }
 
-static inline __word __CASETAGCON (__obj o) { return o->tagged.tag; }
+static inline __word __CASETAGCON (__obj o) { return __conTag(o); }
 
-static inline __word __CASETAGVEC (__obj o) { return o->bv.vec; }
+static inline __word __CASETAGVEC (__obj o) { return __bvVec(o); }
 
-static inline __word __CASETAGINT (__obj o) { return o->z.value; }
+static inline __word __CASETAGINT (__obj o) { return __intValue(o); }
 
+/* Short bitvectors are immediate, so any '1' is `__TRUE`. */
 static inline int __isTrue (__obj o) {
-   return (o == __TRUE); /* TODO: or isBitVec(o)&&value='1' */
+   return (o == __TRUE);
 }
 
 static inline int __isFalse (__obj o) {
-   return (o == __FALSE); /* TODO: or isBitVec(o)&&value='0' */
+   return (o == __FALSE);
 }
 
-static inline void __resetHeap() {
-  hp = &heap[__RT_HEAP_SIZE];
-}
+/* ## Input stream */
+
+/* `high` is the furthest position read before the last `unconsume`; it
+ * is only maintained for the decode cache. `stream` is set while
+ * decoding with `__decodeStream`, which refills the cursor at its end. */
+struct __cursor {
+  __char* start;
+  __char* cur;
+  __char* end;
+  __char* high;
+  struct __stream* stream;
+};
+
+extern __thread struct __cursor __input;
 
 __obj __consume8(__obj);
 __obj __unconsume8(__obj);
@@ -434,6 +904,12 @@ __obj __consume16(__obj);
 __obj __unconsume16(__obj);
 __obj __consume32(__obj);
 __obj __unconsume32(__obj);
+__obj __consumeToken8();
+__obj __unconsumeToken8();
+__obj __consumeToken16();
+__obj __unconsumeToken16();
+__obj __consumeToken32();
+__obj __unconsumeToken32();
 __obj __slice(__obj,__obj,__obj);
 __obj __concat(__obj,__obj);
 __obj __equal(__obj,__obj);
@@ -449,6 +925,8 @@ __obj __concatstring(__obj,__obj);
 __obj __showbitvec(__obj);
 __obj __showint(__obj);
 __obj __flattenstring(__obj,char*,__word);
+__word __flattenRope(__obj,char*,__word,__word);
+__word __ropeLength(__obj);
 
 /** ## Operations on integers */
 
@@ -459,14 +937,195 @@ __obj __addi(__obj,__obj);
 __obj __subi(__obj,__obj);
 __obj __muli(__obj,__obj);
 
-/* ## API helpers */
+/* ## Output buffers
+ *
+ * With `DIRECTSTRINGS` defined (by the code generator's `direct-strings`
+ * control or on the command line) the string primitives do not build
+ * ropes but append to an output buffer, and strings are spans of that
+ * buffer. `__prettyInto` appends the printed object to a caller-owned
+ * buffer, growing it with `realloc` and keeping it NUL-terminated. It
+ * works the same without `DIRECTSTRINGS`, flattening the rope instead.
+ * A span is only valid until the next pretty call or `__resetHeap`. */
+
+struct __buffer {
+  char* data;
+  __word len;
+  __word cap;
+};
+
+__word __prettyInto(__obj(*)(__obj,__obj),__obj,struct __buffer*);
+
+/* Strings produced outside of a pretty call go to a per-thread scratch
+ * buffer, which is released together with the heap. */
+extern __thread struct __buffer __scratch;
+
+static inline void __resetHeap() {
+  __word used = (__heapTop - hp)*sizeof(__word);
+  if (used > __heapCounters.highWater)
+    __heapCounters.highWater = used;
+  __heapCounters.resets++;
+  hp = __heapTop;
+  __scratch.len = 0;
+}
+
+/* ## API helpers
+ *
+ * A decode that runs past the end of its input yields nil, as if nothing
+ * decoded there. */
 
 int ___isNil(__obj);
 __obj __runWithState(__obj(*)(__obj,__obj),__obj);
 __obj __evalPure(__obj(*)(__obj,__obj),__obj);
 __obj __eval(__obj(*)(__obj,__obj),__char*,__word);
 __word __decode(__obj(*)(__obj,__obj),__char*,__word,__obj*);
+__word __decodeLength(__obj(*)(__obj,__obj),__char*,__word);
+
+/* An entry of a linear sweep; undecodable bytes, including those of an
+ * instruction cut off by the end of the buffer, are reported one at a
+ * time with `insn` being nil. */
+struct __decoded {
+  __word offset;
+  __word length;
+  __obj insn;
+};
+
+__word __decodeMany(__obj(*)(__obj,__obj),__char*,__word,struct __decoded*,__word);
+
+/* ## Pipelines
+ *
+ * `__pipeline` decodes on the calling thread and passes batches of
+ * instructions on through stages that run on threads of their own, e.g.
+ * translation, analysis and output; each batch carries the context its
+ * objects live in. A stage sees the batches in order. `stalls` counts
+ * waits for a full next stage, `starved` waits for input (for the
+ * decoder: for a batch to be handed back). */
+
+struct __batch {
+  gdsl_ctx* ctx;
+  __word offset;
+  __word n;
+  struct __decoded* insns;
+  __obj* values;
+};
+
+struct __stage {
+  void (*run)(struct __batch*,void*);
+  void* arg;
+};
+
+struct __pipelineStats {
+  __word batches;
+  __word items;
+  __word stalls;
+  __word starved;
+};
+
+__word __pipeline(__obj(*)(__obj,__obj),__char*,__word,struct __stage*,int,__word,struct __pipelineStats*);
+__obj __printPipelineStats(struct __pipelineStats*,int);
+
+/* ## Streaming input
+ *
+ * `__decodeStream` decodes back to back from a sequence of buffers that
+ * `refill` hands out one at a time, returning NULL at the end; e.g. the
+ * pages of another process or what was read from a pipe. Buffers are
+ * decoded in place; only an instruction that spans two of them is copied
+ * into a staging area. A buffer must stay valid until `refill` is called
+ * again. Returns the length of the instruction at `*offset` (1 with a
+ * nil `insn` if nothing decodes there) or 0 at the end of the stream.
+ * An instruction cut off by the end of the stream comes back as a nil
+ * `insn` covering the bytes that are left.
+ * Caller needs to reset the heap with `__resetHeap()` */
+
+struct __stream {
+  __char* (*refill)(void*,__word*);
+  void* arg;
+  __char* chunk;
+  __word len;
+  __word taken;
+  __char* next;
+  __word offset;
+  int staged;
+  __char* stage;
+  __word stageLen;
+  __word stageCap;
+  int eof;
+  /* staged bytes from `lo` on are `chunk[i+delta]` */
+  ptrdiff_t lo;
+  ptrdiff_t delta;
+};
+
+void __streamInit(struct __stream*,__char*(*)(void*,__word*),void*);
+void __streamFree(struct __stream*);
+__word __decodeStream(struct __stream*,__obj(*)(__obj,__obj),__word*,__obj*);
+
+/* ## Decoder iterators
+ *
+ * Sequential decoding without setting up the decoder's state for every
+ * instruction: `gdsl_iter_init` runs `init` once (e.g. `__decode_init__`,
+ * or NULL for an empty state) and keeps the state it leaves; every
+ * `gdsl_iter_next` runs `next` (e.g. `__decode_next__`) from that state
+ * at the following instruction. The heap is reset on every step, so an
+ * instruction stays valid until the next one. `gdsl_iter_next` returns
+ * the length of the instruction at `*offset` (1 with a nil `insn` if
+ * nothing decodes there) or 0 at the end of the blob. */
+
+typedef struct gdsl_iter {
+  __obj (*next)(__obj,__obj);
+  __obj state;
+  __char* mem;
+  __char* blob;
+  __word sz;
+  __word offset;
+} gdsl_iter;
+
+int gdsl_iter_init(gdsl_iter*,__obj(*)(__obj,__obj),__obj(*)(__obj,__obj),__char*,__word);
+__word gdsl_iter_next(gdsl_iter*,__word*,__obj*);
+void gdsl_iter_free(gdsl_iter*);
+
+/* Superset disassembly: an entry for every byte offset of a range, with
+ * length 0 where nothing decodes, e.g. where an instruction would extend
+ * past the end of the buffer. `__decodeSupersetCached` (see below)
+ * decodes each distinct suffix only once. */
+__word __decodeSuperset(__obj(*)(__obj,__obj),__char*,__word,__word,__word,struct __decoded*);
+
+/* A linear sweep split into chunks for several threads; entries are
+ * reported as bitmaps of their start offsets. */
+__word __sweepParallel(__obj(*)(__obj,__obj),__char*,__word,int,uint64_t*,uint64_t*);
+
+/* ## Decode and translation caches
+ *
+ * `__decodeCached` remembers decoded instructions by the bytes the decoder
+ * read for them, `__translateCached` remembers translations by the
+ * structure of the instruction, so recurring instructions are decoded
+ * and translated only once. Both return copies outside of the heap
+ * (but for the translations of instructions that hold closures, which
+ * are not cached); they stay valid across `__resetHeap` until they are
+ * evicted (least recently used first), the cache is cleared or freed.
+ * A cache holds up to the given number of entries of any of the
+ * functions it is used with and must only be used by one thread at a
+ * time. */
+
+struct __cache;
+
+struct __cacheStats {
+  __word hits;
+  __word misses;
+  __word evictions;
+  __word uncached;
+  __word entries;
+};
+
+struct __cache* __cacheNew(__word);
+void __cacheFree(struct __cache*);
+void __cacheClear(struct __cache*);
+void __cacheSetCapacity(struct __cache*,__word);
+__word __decodeCached(struct __cache*,__obj(*)(__obj,__obj),__char*,__word,__obj*);
+__word __decodeSupersetCached(struct __cache*,__obj(*)(__obj,__obj),__char*,__word,__word,__word,struct __decoded*);
+__obj __translateCached(struct __cache*,__obj(*)(__obj,__obj),__obj);
+void __getCacheStats(struct __cache*,struct __cacheStats*);
+__obj __printCacheStats(struct __cache*);
 __obj __pretty(__obj(*)(__obj,__obj),__obj,char*,__word);
+__word __prettyTo(__obj(*)(__obj,__obj),__obj,char*,__word);
 __obj __translate(__obj(*)(__obj,__obj),__obj);
 
 #endif /* __RUNTIME_H */
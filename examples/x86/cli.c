@@ -1,10 +1,47 @@
 
 /* vim:cindent:ts=2:sw=2:expandtab */
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <dis.h>
+#include <gdsl-batch.h>
 #include <pretty.h>
+#include <string.h>
+
+/* Decodes a single instruction given as hex on stdin. With `-b` hex
+ * lines are decoded in batch, one instruction per line; `-r` sweeps raw
+ * bytes instead and `-j` spreads the lines over several threads. Input
+ * is read from stdin or the given file. */
+
+static void render (__obj insn, struct __buffer* out) {
+  char fmt[1024];
+  prettyln(insn,fmt,1024);
+  gdsl_batch_append(out,fmt,strlen(fmt));
+  gdsl_batch_append(out,"\n",1);
+  prettyln(__translate(__translate__,insn),fmt,1024);
+  gdsl_batch_append(out,fmt,strlen(fmt));
+  gdsl_batch_append(out,"\n",1);
+}
 
 int main (int argc, char** argv) {
+  gdsl_batch batch = {__decode__,render,1,0};
+  int opt, batched = 0;
+  while ((opt = getopt(argc,argv,"brj:")) != -1) {
+    switch (opt) {
+      case 'b': batched = 1; break;
+      case 'r': batched = 1; batch.raw = 1; break;
+      case 'j': batched = 1; batch.threads = atoi(optarg); break;
+      default:
+        fprintf(stderr,"usage: %s [-b] [-r] [-j threads] [file]\n",argv[0]);
+        exit(1);
+    }
+  }
+  if (batched) {
+    int in = 0;
+    if (optind < argc && (in = open(argv[optind],O_RDONLY)) < 0)
+      __fatal("cannot open %s",argv[optind]);
+    return (gdsl_batch_run(&batch,in,1) == 0 ? 0 : 1);
+  }
   __char blob[15];
   char fmt[1024];
   __word sz = 15;
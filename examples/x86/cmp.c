@@ -1,5 +1,5 @@
 
-#include <bfd.h>
+#include <gdsl-elf.h>
 #include <xed-interface.h>
 #include <dis.h>
 #include <pretty.h>
@@ -18,25 +18,15 @@ int main (int argc, char** argv) {
   const char* fn=argv[1];
   printf("file: %s\n",fn);
 
-  bfd_init();
-  const char **targets = bfd_target_list();
-  int i;
-  for (i=0;targets[i]!=NULL;i++) {
-    printf("target: %s\n", targets[i]);
-  }
-  bfd* bfd = bfd_openr(fn, NULL);
-  if (bfd==NULL)
-    __fatal("bfd_openr");
-  if (!bfd_check_format(bfd,bfd_object))
-    __fatal("bfd_check_format");
-  asection* s = bfd_get_section_by_name(bfd, ".text");
-  if (s==NULL)
-    __fatal("bfd_get_section_by_name");
-  __char* blob;
-  bfd_size_type sz = s->size;
+  gdsl_elf elf;
+  gdsl_elf_view text;
+  if (gdsl_elf_open(&elf,fn) != 0)
+    __fatal("gdsl_elf_open");
+  if (gdsl_elf_text(&elf,&text) != 0)
+    __fatal("gdsl_elf_text");
+  __char* blob = (__char*)text.data;
+  size_t sz = text.size;
   printf(".text is %zu bytes\n",sz);
-  if(!bfd_malloc_and_get_section(bfd,s,&blob))
-    __fatal("bfd_malloc_and_get_section");
 
   xed_state_t state;
   xed_decoded_inst_t insnObj;
@@ -6,7 +6,7 @@ static char* append (char* buf, __word sz, const char* str) {
 }
 
 static char* prettyMem (__obj mem, char* buf, __word sz) {
-  __int psz = __RECORD_SELECT(mem,___sz)->z.value;
+  __int psz = __intValue(__RECORD_SELECT(mem,___sz));
   __obj segment = __RECORD_SELECT(mem,___segment);
   __obj opnd = __RECORD_SELECT(mem,___opnd);
   switch (psz) {
@@ -34,7 +34,7 @@ static char* prettyMem (__obj mem, char* buf, __word sz) {
       break;
     }
   }
-  if (segment->tagged.tag == __DS) {
+  if (__conTag(segment) == __DS) {
     buf = append(buf,sz,"[");
   } else {
     buf = prettyOpnd(segment,buf,sz);
@@ -82,16 +82,16 @@ char* prettyImm(__obj imm, __word immSz, char* buf, __word sz) {
   __int x;
   switch (immSz) {
     case 8:
-      x = ((int8_t)imm->bv.vec);
+      x = ((int8_t)__bvVec(imm));
       break;  
     case 16:
-      x = ((int16_t)imm->bv.vec);
+      x = ((int16_t)__bvVec(imm));
       break;  
     case 32:
-      x = ((int32_t)imm->bv.vec);
+      x = ((int32_t)__bvVec(imm));
       break;  
     case 64:
-      x = ((int64_t)imm->bv.vec);
+      x = ((int64_t)__bvVec(imm));
       break;  
     default:
       __fatal("Invalid immidate size");
@@ -107,8 +107,8 @@ char* prettyOpnd (__obj opnd, char* buf, __word sz) {
   char* s = buf;
   switch (__TAG(opnd)) {
     case __TAGGED: {
-      __word tag = opnd->tagged.tag;
-      __obj payload = opnd->tagged.payload;
+      __word tag = __conTag(opnd);
+      __obj payload = __conPayload(opnd);
       switch (tag) {
         case __MEM:
           s = prettyMem(payload,buf,sz);
@@ -141,7 +141,7 @@ char* prettyOpnd (__obj opnd, char* buf, __word sz) {
         case __IMM16:
         case __IMM32:
         case __IMM64:
-          s = prettyImm(payload,payload->bv.sz,buf,sz);
+          s = prettyImm(payload,__bvSize(payload),buf,sz);
           break;
         default: {
           s = append(buf,sz,(const char*)__tagName(tag));
@@ -154,13 +154,13 @@ char* prettyOpnd (__obj opnd, char* buf, __word sz) {
     }
     case __BV: {
       __word l = strlen(buf);
-      snprintf(buf+l,sz-l,"0x%zx",opnd->bv.vec);
+      snprintf(buf+l,sz-l,"0x%zx",__bvVec(opnd));
       s = buf;
       break;
     }
     case __INT: {
       __word l = strlen(buf);
-      snprintf(buf+l,sz-l,"%ld",opnd->z.value);
+      snprintf(buf+l,sz-l,"%ld",__intValue(opnd));
       s = buf;
       break;
     }
@@ -173,7 +173,7 @@ char* prettyOpnd (__obj opnd, char* buf, __word sz) {
 static char* prettyOpnds (__obj opnds, char* buf, __word sz) {
   switch (__TAG(opnds)) {
     case __RECORD: {
-      switch (opnds->record.sz) {
+      switch (__recordSize(opnds)) {
         case 1: {
           __obj op1 = __RECORD_SELECT(opnds,___opnd1);
           return (prettyOpnd(op1,buf,sz));
@@ -216,8 +216,8 @@ static char* prettyOpnds (__obj opnds, char* buf, __word sz) {
       }
     }
     case __TAGGED: {
-      __word tag = opnds->tagged.tag;
-      __obj payload = opnds->tagged.payload;
+      __word tag = __conTag(opnds);
+      __obj payload = __conPayload(opnds);
       switch (tag) {
         case __VA0: return (buf);
         case __VA1:
@@ -254,13 +254,13 @@ char* prettySemArity2 (__obj x, char* buf, __word sz) {
 
 char* prettySemInt (__obj i, char* buf, __word sz) {
   int l = strlen(buf);
-  snprintf(buf+l,sz-l,"%ld",i->z.value);
+  snprintf(buf+l,sz-l,"%ld",__intValue(i));
   return (buf);  
 }
 
 char* prettySemId (__obj x, char* buf, __word sz) {
-  __obj payload = x->tagged.payload;
-  __word tag = x->tagged.tag;
+  __obj payload = __conPayload(x);
+  __word tag = __conTag(x);
   switch (tag) {
     case __VIRT_T: {
       strncat(buf,"t",sz);
@@ -277,7 +277,7 @@ char* prettySemVar (__obj x, char* buf, __word sz) {
   __obj id = __RECORD_SELECT(x,___id);
   __obj offs = __RECORD_SELECT(x,___offset);
   prettySemId(id,buf,sz);
-  if (offs->z.value != 0) {
+  if (__intValue(offs) != 0) {
     strncat(buf,"/",sz); 
     prettySemInt(offs,buf,sz);
   }
@@ -285,8 +285,8 @@ char* prettySemVar (__obj x, char* buf, __word sz) {
 }
 
 char* prettySemLin (__obj lin, char* buf, __word sz) {
-  __obj payload = lin->tagged.payload;
-  __word tag = lin->tagged.tag;
+  __obj payload = __conPayload(lin);
+  __word tag = __conTag(lin);
   switch (tag) {
     case __SEM_LIN_VAR: {
       prettySemVar(payload,buf,sz);
@@ -329,8 +329,8 @@ char* prettySemLin (__obj lin, char* buf, __word sz) {
 }
 
 char* prettySemOp (__obj x, char* buf, __word sz) {
-  __obj payload = x->tagged.payload;
-  __word tag = x->tagged.tag;
+  __obj payload = __conPayload(x);
+  __word tag = __conTag(x);
   __obj size = __RECORD_SELECT(payload,___size);
   switch (tag) {
     case __SEM_LIN: {
@@ -541,8 +541,8 @@ char* prettySemOp (__obj x, char* buf, __word sz) {
 }
 
 char* prettySemStmt (__obj x, char* buf, __word sz) {
-  __obj payload = x->tagged.payload;
-  __word tag = x->tagged.tag;
+  __obj payload = __conPayload(x);
+  __word tag = __conTag(x);
   switch (tag) {
     case __SEM_ASSIGN: {
       __obj lhs = __RECORD_SELECT(payload,___lhs);
@@ -610,8 +610,8 @@ char* prettySemStmt (__obj x, char* buf, __word sz) {
 }
 
 char* prettySemantics (__obj x, char* buf, __word sz) {
-  __obj payload = x->tagged.payload;
-  __word tag = x->tagged.tag;
+  __obj payload = __conPayload(x);
+  __word tag = __conTag(x);
   switch (tag) {
     case __SEM_CONS: {
       __obj hd = __RECORD_SELECT(payload,___hd);
@@ -631,7 +631,7 @@ char* pretty (__obj insn, char* buf, __word sz) {
   buf[0] = '\0';
   switch (__TAG(insn)) {
     case __TAGGED: {
-      __obj payload = insn->tagged.payload;
+      __obj payload = __conPayload(insn);
       __word tag = __CASETAG(insn);
       if (tag == __SEM_CONS || tag == __SEM_NIL) {
         prettySemantics(insn,buf,sz);
@@ -1,5 +1,5 @@
 
-#include <bfd.h>
+#include <gdsl-elf.h>
 #include <xed-interface.h>
 #include <dis.h>
 #include <pretty.h>
@@ -20,7 +20,7 @@ struct insn {
 };
 
 __word getNumberOfOperands(__obj di) {
-  __obj payload = di->tagged.payload;
+  __obj payload = __conPayload(di);
   int n;
   if (___isNil(payload)) {
       n = 0;
@@ -34,17 +34,17 @@ __word getNumberOfOperands(__obj di) {
       default: __fatal("getNumberOfOperands: invalid instruction object");
     }
   } else {
-    n = payload->record.sz;
+    n = __recordSize(payload);
   }
   return (n);
 }
 
 void fmtOperand(__obj di, __word field, char* buf, __word sz) {
-  __obj payload = di->tagged.payload;
+  __obj payload = __conPayload(di);
   buf[0] = '\0'; 
   switch (__TAG(payload)) {
     case __TAGGED:
-      prettyOpnd(__RECORD_SELECT(payload->tagged.payload,field),buf,sz);
+      prettyOpnd(__RECORD_SELECT(__conPayload(payload),field),buf,sz);
       break;
     case __RECORD:
       prettyOpnd(__RECORD_SELECT(payload,field),buf,sz);
@@ -121,25 +121,15 @@ int main (int argc, char** argv) {
   const char* fn=argv[1];
   printf("file: %s\n",fn);
 
-  bfd_init();
-  const char **targets = bfd_target_list();
-  int i;
-  for (i=0;targets[i]!=NULL;i++) {
-    printf("target: %s\n", targets[i]);
-  }
-  bfd* bfd = bfd_openr(fn, NULL);
-  if (bfd==NULL)
-    __fatal("bfd_openr");
-  if (!bfd_check_format(bfd,bfd_object))
-    __fatal("bfd_check_format");
-  asection* s = bfd_get_section_by_name(bfd, ".text");
-  if (s==NULL)
-    __fatal("bfd_get_section_by_name");
-  __char* blob;
-  bfd_size_type sz = s->size;
+  gdsl_elf elf;
+  gdsl_elf_view text;
+  if (gdsl_elf_open(&elf,fn) != 0)
+    __fatal("gdsl_elf_open");
+  if (gdsl_elf_text(&elf,&text) != 0)
+    __fatal("gdsl_elf_text");
+  __char* blob = (__char*)text.data;
+  size_t sz = text.size;
   printf(".text is %zu bytes\n",sz);
-  if(!bfd_malloc_and_get_section(bfd,s,&blob))
-    __fatal("bfd_malloc_and_get_section");
 
   xed_state_t state;
   xed_decoded_inst_t insnObj;
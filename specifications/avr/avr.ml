@@ -1,5 +1,5 @@
 granularity = 16
-export = decode
+export = decode decode-init decode-next
 
 val d ['bit:1'] = do
  rd <- query $rd;
@@ -552,10 +552,15 @@ val / ['1001010110101000'] = nullop WDR
 val / ['1001001 d d d d d 0100'] = binop XCH /Z rd5
 
 val decode =
-  do update@{rd='',rr='',ck='',cs='',cb='',io='',dq=''};
-     /
+  do decode-init;
+     decode-next
   end
 
+# See `decode-init` in the x86 specification.
+val decode-init = update@{rd='',rr='',ck='',cs='',cb='',io='',dq=''}
+
+val decode-next = /
+
 
 type side-effect =
    NONE
@@ -3,25 +3,28 @@
 
 #include <dis.h>
 
+static void prettyln (__obj (*f)(__obj,__obj), __obj x) {
+  static struct __buffer out;
+  out.len = 0;
+  __prettyInto(f,x,&out);
+  puts(out.data);
+}
+
 void sweep (__char* blob, __word sz) {
-  char fmt[4096];
   __obj state = __eval(__lv_sweep_and_collect_upto_native_flow__,blob,sz);
   __obj stmts = __RECORD_SELECT(state,___1);
-  __pretty(__rreil_pretty_rev__,stmts,fmt,4096);
-  puts(fmt);
+  prettyln(__rreil_pretty_rev__,stmts);
 }
 
 void liveness (__char* blob, __word sz) {
-  char fmtlive[4096];
-  char fmtmaybelive[4096];
   __obj result = __eval(__lv_analyze__,blob,sz);
   __obj state = __RECORD_SELECT(result,___2);
   __obj live = __RECORD_SELECT(state,___live);
   __obj maybelive = __RECORD_SELECT(state,___maybelive);
-  __pretty(__rreil_pretty__,live,fmtlive,4096);
-  __pretty(__rreil_pretty__,maybelive,fmtmaybelive,4096);
-  puts("live:"); puts(fmtlive);
-  puts("maybelive:"); puts(fmtmaybelive);
+  puts("live:");
+  prettyln(__rreil_pretty__,live);
+  puts("maybelive:");
+  prettyln(__rreil_pretty__,maybelive);
 }
 
 int main (int argc, char** argv) {
@@ -1,5 +1,5 @@
 granularity = 8
-export = decode
+export = decode decode-init decode-next
 
 # Optional arguments
 #
@@ -16,6 +16,13 @@ export = decode
 # recursion-depth = p64 = 4
 
 val decode = do
+   decode-init;
+   decode-next
+end
+
+# The state every instruction is decoded from; iterators (`gdsl_iter_init`)
+# set it up once and then only run `decode-next`.
+val decode-init =
    update
       @{mode64='1',
         repne='0',
@@ -29,9 +36,9 @@ val decode = do
         addrsz='0',
         lock='0',
         segment=DS,
-        ptrty=32}; #TODO: check
-   p64
-end
+        ptrty=32} #TODO: check
+
+val decode-next = p64
 
 val complement v = not v
 
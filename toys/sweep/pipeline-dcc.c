@@ -0,0 +1,86 @@
+#include <gdsl-elf.h>
+#include <unistd.h>
+#include <dis.h>
+
+/* Linear sweep of `.text` as a pipeline: decoding, translation to RREIL
+ * and printing each run on a thread of their own, handing batches of
+ * instructions on. With `-q` nothing is printed; `-s` prints the
+ * throughput and back-pressure counters of every stage. */
+
+static void translate (struct __batch* b, void* arg) {
+  __word i;
+  for (i=0;i<b->n;i++)
+    b->values[i] = ___isNil(b->insns[i].insn) ?
+      __UNIT : __translate(__translate__,b->insns[i].insn);
+}
+
+struct output {
+  struct __buffer buf;
+  int quiet;
+};
+
+static void output (struct __batch* b, void* arg) {
+  struct output* o = arg;
+  __word i;
+  if (o->quiet)
+    return;
+  for (i=0;i<b->n;i++) {
+    char addr[32];
+    int k = snprintf(addr,sizeof(addr),"%08zx:\n",(size_t)b->insns[i].offset);
+    fwrite(addr,1,k,stdout);
+    if (___isNil(b->values[i]))
+      fputs("invalid\n",stdout);
+    else {
+      __prettyInto(__rreil_pretty__,b->values[i],&o->buf);
+      fwrite(o->buf.data,1,o->buf.len,stdout);
+      fputc('\n',stdout);
+      o->buf.len = 0;
+    }
+  }
+}
+
+int main (int argc, char** argv) {
+  int opt, stats = 0;
+  __word batch = 1024;
+  struct output out = {{0}};
+  while ((opt = getopt(argc,argv,"b:qs")) != -1) {
+    switch (opt) {
+      case 'b': batch = atol(optarg); break;
+      case 'q': out.quiet = 1; break;
+      case 's': stats = 1; break;
+      default:
+        fprintf(stderr,"usage: %s [-b batch] [-q] [-s] file\n",argv[0]);
+        exit(1);
+    }
+  }
+  if (optind >= argc || batch == 0)
+    exit(1);
+  const char* fn=argv[optind];
+  fprintf(stderr,"file is %s\n",fn);
+
+  gdsl_elf elf;
+  gdsl_elf_view text;
+  if (gdsl_elf_open(&elf,fn) != 0)
+    exit(1);
+  if (gdsl_elf_text(&elf,&text) != 0)
+    exit(1);
+  unsigned char* blob = (unsigned char*)text.data;
+  size_t sz = text.size;
+  fprintf(stderr,".text is %zu bytes\n",sz);
+
+  struct __stage stages[] = {{translate,NULL},{output,&out}};
+  struct __pipelineStats counters[3];
+  __word n = __pipeline(__decode__,blob,sz,stages,2,batch,counters);
+  fflush(stdout);
+  fprintf(stderr,"decoded %zu instructions\n",(size_t)n);
+  if (stats)
+    __printPipelineStats(counters,2);
+  free(out.buf.data);
+  gdsl_elf_close(&elf);
+  return (0);
+}
+
+/* vim:cindent
+ * vim:ts=2
+ * vim:sw=2
+ * vim:expandtab */
@@ -0,0 +1,132 @@
+#include <gdsl-elf.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dis.h>
+
+/* Superset disassembly of `.text`: decodes at every byte offset and
+ * records the instruction length found there (0 if nothing decodes or
+ * the instruction would run past the end of the section).
+ * The section is split into one chunk per thread; every thread decodes
+ * with its own implicit context. With `-c` every thread decodes through
+ * a decode cache of that many entries, so that recurring byte sequences
+ * are decoded only once. With `-DLENGTHONLY` the length-only variant of
+ * the decoder is used (see the `length-only` control). */
+
+#ifdef LENGTHONLY
+#define DECODER __decode_length__
+#else
+#define DECODER __decode__
+#endif
+
+#define BATCH 4096
+
+struct chunk {
+  pthread_t thread;
+  unsigned char* blob;
+  __word sz;
+  __word from;
+  __word to;
+  unsigned char* lengths;
+  __word valid;
+  __word capacity;
+  struct __cacheStats stats;
+};
+
+static void* superset (void* arg) {
+  struct chunk* c = arg;
+  struct __decoded* insns = malloc(BATCH*sizeof(struct __decoded));
+  if (insns == NULL)
+    return (NULL);
+  struct __cache* cache = c->capacity > 0 ? __cacheNew(c->capacity) : NULL;
+  __word off = c->from;
+  while (off < c->to) {
+    __word to = off + BATCH < c->to ? off + BATCH : c->to;
+    __word i, k = cache != NULL ?
+      __decodeSupersetCached(cache,DECODER,c->blob,c->sz,off,to,insns) :
+      __decodeSuperset(DECODER,c->blob,c->sz,off,to,insns);
+    for (i=0;i<k;i++) {
+      c->lengths[off+i] = insns[i].length;
+      if (insns[i].length > 0)
+        c->valid++;
+    }
+    off += k;
+  }
+  if (cache != NULL) {
+    __getCacheStats(cache,&c->stats);
+    __cacheFree(cache);
+  }
+  free(insns);
+  return (NULL);
+}
+
+int main (int argc, char** argv) {
+  int opt, table = 0;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  __word capacity = 0;
+  while ((opt = getopt(argc,argv,"j:tc:")) != -1) {
+    switch (opt) {
+      case 'j': threads = atol(optarg); break;
+      case 't': table = 1; break;
+      case 'c': capacity = atol(optarg); break;
+      default:
+        fprintf(stderr,"usage: %s [-j threads] [-t] [-c entries] file\n",argv[0]);
+        exit(1);
+    }
+  }
+  if (optind >= argc)
+    exit(1);
+  if (threads < 1)
+    threads = 1;
+  const char* fn=argv[optind];
+  fprintf(stderr,"file is %s\n",fn);
+
+  gdsl_elf elf;
+  gdsl_elf_view text;
+  if (gdsl_elf_open(&elf,fn) != 0)
+    exit(1);
+  if (gdsl_elf_text(&elf,&text) != 0)
+    exit(1);
+  unsigned char* blob = (unsigned char*)text.data;
+  size_t sz = text.size;
+
+  fprintf(stderr,".text is %zu bytes\n",sz);
+
+  unsigned char* lengths = calloc(sz,1);
+  struct chunk* chunks = calloc(threads,sizeof(struct chunk));
+  if (lengths == NULL || chunks == NULL)
+    exit(1);
+  __word per = (sz + threads - 1)/threads;
+  long t;
+  for (t=0;t<threads;t++) {
+    struct chunk* c = &chunks[t];
+    c->blob = blob;
+    c->sz = sz;
+    c->from = t*per < sz ? t*per : sz;
+    c->to = c->from + per < sz ? c->from + per : sz;
+    c->lengths = lengths;
+    c->capacity = capacity;
+    pthread_create(&c->thread,NULL,superset,c);
+  }
+  __word valid = 0, hits = 0;
+  for (t=0;t<threads;t++) {
+    pthread_join(chunks[t].thread,NULL);
+    valid += chunks[t].valid;
+    hits += chunks[t].stats.hits;
+  }
+
+  if (table) {
+    size_t i;
+    for (i=0;i<sz;i++)
+      printf("%zx %u\n",(size_t)i,lengths[i]);
+  }
+  fprintf(stderr,"decoded %zu offsets (%zu invalid/unknown) with %ld threads\n",
+    (size_t)sz, (size_t)(sz - valid), threads);
+  if (capacity > 0)
+    fprintf(stderr,"%zu offsets answered from the cache\n",(size_t)hits);
+  return (0);
+}
+
+/* vim:cindent
+ * vim:ts=2
+ * vim:sw=2
+ * vim:expandtab */
@@ -1,5 +1,6 @@
 
-#include <bfd.h>
+#include <gdsl-elf.h>
+#include <unistd.h>
 #include <dis.h>
 #include <pretty.h>
 
@@ -11,48 +12,132 @@ void hexlify (unsigned char* in, size_t len, char* out) {
   }
 }
 
+/* Prints the offsets and lengths of the entries found by a sweep. */
+void table (uint64_t* starts, uint64_t* invalid, size_t sz) {
+  size_t i, start = 0;
+  int valid = 0, first = 1;
+  for (i=0;i<=sz;i++) {
+    if (i == sz || (starts[i/64] >> (i%64)) & 1) {
+      if (!first)
+        printf("%zx %zu%s\n",start,i-start,valid ? "" : " invalid");
+      first = 0;
+      start = i;
+      valid = i < sz && !((invalid[i/64] >> (i%64)) & 1);
+    }
+  }
+}
+
+/* With `-j` the sweep is split among that many threads by
+ * `__sweepParallel`, otherwise it is done by `__decodeMany` alone; the
+ * tables of both must be the same (`make check-parallel`).
+ * With `-g` every instruction is decoded on its own and the heap is
+ * collected after each, with the instruction as the only root; it must
+ * print the same before and after, and the table must be the one of
+ * `__decodeMany` (`make check-gc`). This needs a runtime built with
+ * `-DWITHGC`.
+ * With `-m` the heap statistics of the sweep are printed; the bytes per
+ * instruction and the objects by tag are only counted by a runtime built
+ * with `-DWITHSTATS` (`make dcc DEFS=-DWITHSTATS`). Worker threads keep
+ * counters of their own, so these cover sequential sweeps only. */
+
 int main (int argc, char** argv) {
-  if (argc < 2)
+  int opt, threads = 0, print = 0, stats = 0, collect = 0;
+  while ((opt = getopt(argc,argv,"j:tmg")) != -1) {
+    switch (opt) {
+      case 'j': threads = atoi(optarg); break;
+      case 't': print = 1; break;
+      case 'm': stats = 1; break;
+      case 'g': collect = 1; break;
+      default:
+        fprintf(stderr,"usage: %s [-j threads] [-t] [-m] [-g] file\n",argv[0]);
+        exit(1);
+    }
+  }
+  if (optind >= argc)
     exit(1);
-  const char* fn=argv[1];
+  const char* fn=argv[optind];
   fprintf(stderr,"file is %s\n",fn);
 
-  bfd_init();
-  bfd* bfd = bfd_openr(fn, NULL);
-  if (bfd==NULL)
-    exit(1);
-  if (!bfd_check_format(bfd,bfd_object))
+  gdsl_elf elf;
+  gdsl_elf_view text;
+  if (gdsl_elf_open(&elf,fn) != 0)
     exit(1);
-  asection* s = bfd_get_section_by_name(bfd,".text");
-  if (s==NULL)
+  if (gdsl_elf_text(&elf,&text) != 0)
     exit(1);
-  unsigned char* blob;
-  bfd_size_type sz = s->size;
+  unsigned char* blob = (unsigned char*)text.data;
+  size_t sz = text.size;
 
   fprintf(stderr,".text is %zu bytes\n",sz);
 
-  if(!bfd_malloc_and_get_section(bfd,s,&blob))
+  size_t words = (sz + 63)/64;
+  uint64_t* starts = calloc(words+1,sizeof(uint64_t));
+  uint64_t* invalids = calloc(words+1,sizeof(uint64_t));
+  if (starts == NULL || invalids == NULL)
     exit(1);
 
-  __word len;
-  unsigned char* blobb = blob;
   unsigned int invalid = 0;
   unsigned int n = 0;
-  __obj insn;
-  do {
-    len = __decode(__decode__,blobb,sz,&insn);
-    if (___isNil(insn)) {
-      invalid++;
-      len = 1;
-    } else {
-      //prettyln(insn);
+  if (threads > 0) {
+    size_t i;
+    n = __sweepParallel(__decode__,blob,sz,threads,starts,invalids);
+    for (i=0;i<words;i++)
+      invalid += __builtin_popcountll(invalids[i]);
+  } else if (collect) {
+    char before[256], after[256];
+    struct __gcStats gc;
+    __obj insn = __UNIT;
+    __word off = 0;
+    __gcRoot(&insn);
+    while (off < sz) {
       __resetHeap();
+      __word len = __decode(__decode__,blob+off,sz-off,&insn);
+      starts[off/64] |= (uint64_t)1 << (off%64);
+      if (len == 0) {
+        invalids[off/64] |= (uint64_t)1 << (off%64);
+        invalid++;
+        len = 1;
+      } else {
+        __prettyTo(__pretty__,insn,before,sizeof(before));
+        __gcCollect();
+        __prettyTo(__pretty__,insn,after,sizeof(after));
+        if (strcmp(before,after) != 0) {
+          fprintf(stderr,"%zx: '%s' is '%s' after a collection\n",off,before,after);
+          exit(1);
+        }
+      }
+      n++;
+      off += len;
+    }
+    __gcUnroot(&insn);
+    __getGCStats(&gc);
+    if (gc.collections == 0) {
+      fprintf(stderr,"the runtime does not collect, build it with -DWITHGC\n");
+      exit(1);
     }
-    blobb += len;
-    sz -= len;
-    n++;
-  } while(len > 0 && sz > 0);
+    fprintf(stderr,"%zu collections\n",gc.collections);
+  } else {
+    struct __decoded insns[1024];
+    __word off = 0;
+    while (off < sz) {
+      __word i, k = __decodeMany(__decode__,blob+off,sz-off,insns,1024);
+      for (i=0;i<k;i++) {
+        __word at = off + insns[i].offset;
+        starts[at/64] |= (uint64_t)1 << (at%64);
+        if (___isNil(insns[i].insn)) {
+          invalids[at/64] |= (uint64_t)1 << (at%64);
+          invalid++;
+        }
+        //else prettyln(insns[i].insn);
+      }
+      n += k;
+      off += insns[k-1].offset + insns[k-1].length;
+    }
+  }
+  if (print)
+    table(starts,invalids,sz);
   fprintf(stderr,"decoded %u opcode sequences (%u invalid/unknown)\n", n, invalid);
+  if (stats)
+    __printHeapStats();
   return (0);
 }
 
@@ -1,6 +1,7 @@
 
 #include <stdlib.h>
-#include <bfd.h>
+#include <stdio.h>
+#include <gdsl-elf.h>
 #include <udis86.h>
 
 int main (int argc, char** argv) {
@@ -10,25 +11,16 @@ int main (int argc, char** argv) {
 
   fprintf(stderr,"file is %s\n",fn);
 
-  bfd_init();
-  bfd* bfd = bfd_openr(fn, NULL);
-  if (bfd==NULL)
+  gdsl_elf elf;
+  gdsl_elf_view text;
+  if (gdsl_elf_open(&elf,fn) != 0)
     exit(1);
-
-  if (!bfd_check_format(bfd,bfd_object))
-    exit(1);
-
-  asection* s = bfd_get_section_by_name(bfd,".text");
-  if (s==NULL)
+  if (gdsl_elf_text(&elf,&text) != 0)
     exit(1);
-
-  unsigned char* blob;
-  bfd_size_type sz = s->size;
+  unsigned char* blob = (unsigned char*)text.data;
+  size_t sz = text.size;
   fprintf(stderr,".text is %zu bytes\n",sz);
 
-  if(!bfd_malloc_and_get_section(bfd,s,&blob))
-    exit(1);
-
   ud_t udisObj;
   ud_t* udis = &udisObj;
   ud_init(udis);